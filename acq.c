@@ -0,0 +1,627 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <iio.h>
+
+#include "acq.h"
+#include "adclog.h"
+#include "cal.h"
+#include "dsp.h"
+#include "hist.h"
+#include "loop.h"
+#include "ring.h"
+#include "stats.h"
+
+#define ACQ_ADC_DEV "2198000.adc"
+#define ACQ_PERIOD_NS (100 * 1000000ULL)
+
+/* Buffered capture is paced by an hrtimer trigger, created through configfs.
+ * A batch of scans is handed over at the same 100 ms cadence as polling.
+ */
+#define ACQ_TRIG_NAME "acq-adc"
+#define ACQ_TRIG_DIR "/sys/kernel/config/iio/triggers/hrtimer/" ACQ_TRIG_NAME
+#define ACQ_SCAN_HZ 1000
+#define ACQ_BUF_SCANS (ACQ_SCAN_HZ / 10)
+#define ACQ_SCAN_PERIOD_NS (1000000000ULL / ACQ_SCAN_HZ)
+
+/* mV per LSB at the ADC, for a channel with no readable IIO scale. A 12 bit
+ * conversion of a 3.3 V reference.
+ */
+#define ACQ_ADC_SCALE_DEFAULT (3300.0 / 4095)
+
+#define ACQ_ADC_MAX 8
+#define ACQ_DSP_GROUPS (ACQ_ADC_MAX / DSP_LANES)
+
+/* Rates of the filter chain for buffered capture: means of 4 at 250 Hz,
+ * then a second order CIC down to 15.625 Hz. Polled samples are already
+ * slow, they only go through the median and IIR.
+ */
+#define ACQ_DSP_BOXCAR 4
+#define ACQ_DSP_CIC_RATE 16
+#define ACQ_DSP_CIC_ORDER 2
+
+/* Enough for several seconds of every source, should the UI stall */
+#define ACQ_RING_SLOTS 256
+
+struct acq_adc {
+    const char *chan_name;
+    struct iio_channel *iio_chan;
+    const struct iio_data_format *fmt;
+    const struct acq_adc_cal *cal;
+    const struct dsp_chan_cfg *filter;
+    /* cal_init() of each mode, set up once the IIO scale is known */
+    struct cal conv[ACQ_ADC_MODE_MAX];
+    atomic_int mode;
+};
+
+static struct acq_adc acq_adc[ACQ_ADC_MAX];
+static unsigned int acq_adc_cnt;
+
+/* Channels are filtered DSP_LANES at a time, in the order they were added */
+static struct dsp acq_dsp[ACQ_DSP_GROUPS];
+
+static acq_cb_t acq_cb[ACQ_KIND_MAX];
+
+static struct ring acq_ring;
+static int acq_event_fd = -1;
+
+/* Active flags, the thread sleeps on the condition while nothing is */
+static pthread_mutex_t acq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t acq_cond = PTHREAD_COND_INITIALIZER;
+static bool acq_active[ACQ_KIND_MAX];
+
+/* Whether the UI wants each sample, see acq_set_notify() */
+static atomic_bool acq_notify[ACQ_KIND_MAX];
+
+/* Set if this process created the hrtimer trigger, rather than finding one */
+static bool acq_trig_created;
+
+static uint64_t acq_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void acq_set_cb(enum acq_kind kind, acq_cb_t cb)
+{
+    acq_cb[kind] = cb;
+}
+
+int acq_adc_add(const char *chan_name, const struct acq_adc_cal *cal,
+  const struct dsp_chan_cfg *filter)
+{
+    if (acq_adc_cnt == ACQ_ADC_MAX)
+        return -1;
+
+    acq_adc[acq_adc_cnt].chan_name = chan_name;
+    acq_adc[acq_adc_cnt].cal = cal;
+    acq_adc[acq_adc_cnt].filter = filter;
+    return acq_adc_cnt++;
+}
+
+void acq_adc_set_mode(int chan, enum acq_adc_mode mode)
+{
+    if (chan < 0 || chan >= (int)acq_adc_cnt)
+        return;
+
+    atomic_store_explicit(&acq_adc[chan].mode, mode, memory_order_relaxed);
+}
+
+/* Work out the conversion of each mode from the channel's IIO attributes.
+ * A mode whose gain is out of range converts everything to 0, rather than
+ * something that looks plausible.
+ */
+static void acq_adc_cal_setup(struct acq_adc *adc)
+{
+    double scale = ACQ_ADC_SCALE_DEFAULT, offset = 0;
+    int mode;
+
+    if (adc->iio_chan != NULL) {
+        iio_channel_attr_read_double(adc->iio_chan, "scale", &scale);
+        iio_channel_attr_read_double(adc->iio_chan, "offset", &offset);
+    }
+
+    for (mode = 0; mode < ACQ_ADC_MODE_MAX; mode++) {
+        if (cal_init(&adc->conv[mode], scale, offset, adc->cal[mode].gain,
+          adc->cal[mode].bias) == -1) {
+            fprintf(stderr, "%s: calibration out of range\n", adc->chan_name);
+            adc->conv[mode] = (struct cal){ 0, 0 };
+        }
+    }
+}
+
+/* The mode is only looked at once per batch, never per sample. Channels in
+ * current mode are flagged in `modes`, for the log.
+ */
+static const struct cal *acq_adc_conv(unsigned int chan, uint8_t *modes)
+{
+    struct acq_adc *adc = &acq_adc[chan];
+    int mode = atomic_load_explicit(&adc->mode, memory_order_relaxed);
+
+    if (mode == ACQ_ADC_CURRENT)
+        *modes |= 1U << chan;
+    return &adc->conv[mode];
+}
+
+/* Hand the calibrated samples to the logger, if it's running */
+static void acq_log(int32_t (*samples)[ACQ_BUF_SCANS], const bool *valid,
+  unsigned int scans, uint64_t ts_ns, uint32_t period_ns, uint8_t modes)
+{
+    static const int32_t zero[ACQ_BUF_SCANS];
+    const int32_t *chan[ACQ_ADC_MAX];
+    uint8_t mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < acq_adc_cnt; i++) {
+        chan[i] = valid[i] ? samples[i] : zero;
+        if (valid[i])
+            mask |= 1U << i;
+    }
+
+    adclog_push(chan, acq_adc_cnt, scans, ts_ns, period_ns, mask, modes);
+}
+
+static bool acq_publish(enum acq_kind kind, unsigned int chan, int32_t value,
+  uint64_t ts_ns)
+{
+    struct acq_sample sample = {
+        .ts_ns = ts_ns,
+        .kind = kind,
+        .chan = chan,
+        .value = value,
+    };
+
+    if (!atomic_load_explicit(&acq_notify[kind], memory_order_relaxed))
+        return false;
+
+    /* If the UI has fallen this far behind, dropping is the right call */
+    return ring_push(&acq_ring, &sample);
+}
+
+/* Start the filters afresh, whenever there's been a gap in the samples.
+ * Channels with settings dsp_init() won't take are passed straight through.
+ */
+static void acq_dsp_init(bool buffered)
+{
+    struct dsp_cfg cfg = {
+        .boxcar = buffered ? ACQ_DSP_BOXCAR : 1,
+        .cic_rate = buffered ? ACQ_DSP_CIC_RATE : 1,
+        .cic_order = ACQ_DSP_CIC_ORDER,
+    };
+    unsigned int g, l, i;
+
+    for (g = 0; g < ACQ_DSP_GROUPS; g++) {
+        for (l = 0; l < DSP_LANES; l++) {
+            i = (g * DSP_LANES) + l;
+            cfg.chan[l] = (struct dsp_chan_cfg){ false, DSP_ALPHA_ONE };
+            if (i < acq_adc_cnt && acq_adc[i].filter != NULL)
+                cfg.chan[l] = *acq_adc[i].filter;
+        }
+
+        if (dsp_init(&acq_dsp[g], &cfg) == 0)
+            continue;
+
+        fprintf(stderr, "ADC filter settings out of range, not filtering\n");
+        for (l = 0; l < DSP_LANES; l++)
+            cfg.chan[l] = (struct dsp_chan_cfg){ false, DSP_ALPHA_ONE };
+        dsp_init(&acq_dsp[g], &cfg);
+    }
+}
+
+/* Run `scans` scans of every channel, laid out channel by channel, through
+ * the filters, and add what comes out to the history and publish it. `ts_ns` is the time of the last
+ * scan and `period_ns` the time between them. Channels that aren't being
+ * sampled are fed 0 and never published.
+ */
+static bool acq_dsp_run(int32_t (*samples)[ACQ_BUF_SCANS], const bool *valid,
+  unsigned int scans, uint64_t ts_ns, uint64_t period_ns)
+{
+    static int32_t in[ACQ_BUF_SCANS][DSP_LANES];
+    static int32_t out[ACQ_BUF_SCANS][DSP_LANES];
+    static unsigned int out_at[ACQ_BUF_SCANS];
+    unsigned int g, l, i, s, m;
+    bool pushed = false;
+    uint64_t at_ns;
+
+    for (g = 0; g * DSP_LANES < acq_adc_cnt; g++) {
+        /* Interleave, so that each scan is one vector of channels */
+        for (l = 0; l < DSP_LANES; l++) {
+            i = (g * DSP_LANES) + l;
+            for (s = 0; s < scans; s++)
+                in[s][l] = (i < acq_adc_cnt && valid[i]) ? samples[i][s] : 0;
+        }
+
+        m = dsp_run(&acq_dsp[g], in[0], scans, out[0], out_at);
+
+        for (s = 0; s < m; s++) {
+            at_ns = ts_ns - ((scans - 1 - out_at[s]) * period_ns);
+            for (l = 0; l < DSP_LANES; l++) {
+                i = (g * DSP_LANES) + l;
+                if (i >= acq_adc_cnt || !valid[i])
+                    continue;
+                hist_add(i, at_ns, out[s][l]);
+                pushed |= acq_publish(ACQ_ADC, i, out[s][l], at_ns);
+            }
+        }
+    }
+
+    return pushed;
+}
+
+void acq_set_active(enum acq_kind kind, bool active)
+{
+    pthread_mutex_lock(&acq_lock);
+    acq_active[kind] = active;
+    pthread_cond_signal(&acq_cond);
+    pthread_mutex_unlock(&acq_lock);
+}
+
+void acq_set_notify(enum acq_kind kind, bool notify)
+{
+    atomic_store_explicit(&acq_notify[kind], notify, memory_order_relaxed);
+}
+
+/* Point the ADC at the hrtimer trigger, at the scan rate. The trigger must
+ * have been created before the IIO context for libiio to know about it. If
+ * it couldn't be, one already set on the ADC by someone else is used as is.
+ * Returns false if there is neither.
+ */
+static bool acq_trigger_setup(struct iio_context *ctx, struct iio_device *dev)
+{
+    const struct iio_device *trig;
+    const char *name;
+    unsigned int i;
+
+    for (i = 0; i < iio_context_get_devices_count(ctx); i++) {
+        trig = iio_context_get_device(ctx, i);
+        name = iio_device_get_name(trig);
+        if (!iio_device_is_trigger(trig) || name == NULL ||
+          strcmp(name, ACQ_TRIG_NAME) != 0)
+            continue;
+
+        iio_device_attr_write_longlong(trig, "sampling_frequency",
+          ACQ_SCAN_HZ);
+        return iio_device_set_trigger(dev, trig) == 0;
+    }
+
+    return iio_device_get_trigger(dev, &trig) == 0 && trig != NULL;
+}
+
+/* Once buffered capture is given up on, take the hrtimer trigger off the ADC
+ * and remove it again, but only if this process created it. One that was
+ * already there is left alone.
+ */
+static void acq_trigger_remove(struct iio_device *dev)
+{
+    const struct iio_device *trig;
+    const char *name;
+
+    if (!acq_trig_created)
+        return;
+
+    if (dev != NULL && iio_device_get_trigger(dev, &trig) == 0 &&
+      trig != NULL) {
+        name = iio_device_get_name(trig);
+        if (name != NULL && strcmp(name, ACQ_TRIG_NAME) == 0)
+            iio_device_set_trigger(dev, NULL);
+    }
+    rmdir(ACQ_TRIG_DIR);
+    acq_trig_created = false;
+}
+
+/* Only little and big endian 8, 16, or 32 bit samples are handled, which
+ * covers any ADC likely to be behind this. Returns false for anything else.
+ */
+static bool acq_buf_format_ok(const struct iio_data_format *fmt)
+{
+    return fmt != NULL && fmt->repeat <= 1 && fmt->bits > 0 &&
+      (fmt->length == 8 || fmt->length == 16 || fmt->length == 32);
+}
+
+static int32_t acq_buf_raw(const struct iio_data_format *fmt, const void *p)
+{
+    uint32_t v, mask;
+
+    switch (fmt->length) {
+    case 8:
+        v = *(const uint8_t *)p;
+        break;
+    case 16:
+        v = *(const uint16_t *)p;
+        if (fmt->is_be)
+            v = __builtin_bswap16(v);
+        break;
+    default:
+        v = *(const uint32_t *)p;
+        if (fmt->is_be)
+            v = __builtin_bswap32(v);
+        break;
+    }
+
+    v >>= fmt->shift;
+    if (fmt->bits >= 32)
+        return v;
+
+    mask = (1U << fmt->bits) - 1;
+    v &= mask;
+    if (fmt->is_signed && (v & (1U << (fmt->bits - 1))))
+        v |= ~mask;
+
+    return v;
+}
+
+/* Enable the channels and start capture. Returns NULL if the device can't
+ * do buffered capture of them, polling sysfs is left as the only way then.
+ */
+static struct iio_buffer *acq_buf_open(struct iio_device *dev)
+{
+    struct iio_buffer *buf;
+    unsigned int i, n = 0;
+
+    for (i = 0; i < acq_adc_cnt; i++) {
+        if (acq_adc[i].iio_chan == NULL)
+            continue;
+        acq_adc[i].fmt = iio_channel_get_data_format(acq_adc[i].iio_chan);
+        if (!acq_buf_format_ok(acq_adc[i].fmt))
+            goto out;
+        iio_channel_enable(acq_adc[i].iio_chan);
+        n++;
+    }
+    if (n == 0)
+        goto out;
+
+    buf = iio_device_create_buffer(dev, ACQ_BUF_SCANS, false);
+    if (buf != NULL)
+        return buf;
+
+out:
+    for (i = 0; i < acq_adc_cnt; i++) {
+        if (acq_adc[i].iio_chan != NULL)
+            iio_channel_disable(acq_adc[i].iio_chan);
+    }
+    return NULL;
+}
+
+static void acq_buf_close(struct iio_buffer *buf)
+{
+    unsigned int i;
+
+    iio_buffer_destroy(buf);
+    for (i = 0; i < acq_adc_cnt; i++) {
+        if (acq_adc[i].iio_chan != NULL)
+            iio_channel_disable(acq_adc[i].iio_chan);
+    }
+}
+
+/* Wait for a batch of scans and demux it in one pass, then convert each
+ * channel's samples in one go and filter them all together. Returns -1 on
+ * error.
+ */
+static int acq_buf_read(struct iio_buffer *buf, bool *pushed)
+{
+    static int32_t samples[ACQ_ADC_MAX][ACQ_BUF_SCANS];
+    const uint8_t *first[ACQ_ADC_MAX];
+    bool valid[ACQ_ADC_MAX];
+    const uint8_t *start, *end;
+    unsigned int i, s, scans;
+    uint8_t modes = 0;
+    ptrdiff_t step;
+    uint64_t ts_ns;
+
+    if (iio_buffer_refill(buf) < 0)
+        return -1;
+    ts_ns = acq_now_ns();
+
+    start = iio_buffer_start(buf);
+    end = iio_buffer_end(buf);
+    step = iio_buffer_step(buf);
+    if (step <= 0)
+        return -1;
+    scans = (end - start) / step;
+    if (scans > ACQ_BUF_SCANS)
+        scans = ACQ_BUF_SCANS;
+    if (scans == 0)
+        return 0;
+
+    for (i = 0; i < acq_adc_cnt; i++) {
+        first[i] = NULL;
+        if (acq_adc[i].iio_chan != NULL)
+            first[i] = iio_buffer_first(buf, acq_adc[i].iio_chan);
+        valid[i] = (first[i] != NULL);
+    }
+
+    for (s = 0; s < scans; s++) {
+        for (i = 0; i < acq_adc_cnt; i++) {
+            if (first[i] != NULL)
+                samples[i][s] = acq_buf_raw(acq_adc[i].fmt,
+                  first[i] + (s * step));
+        }
+    }
+
+    for (i = 0; i < acq_adc_cnt; i++) {
+        if (valid[i])
+            cal_apply(acq_adc_conv(i, &modes), samples[i], samples[i], scans);
+    }
+    acq_log(samples, valid, scans, ts_ns, ACQ_SCAN_PERIOD_NS, modes);
+    *pushed |= acq_dsp_run(samples, valid, scans, ts_ns, ACQ_SCAN_PERIOD_NS);
+    stats_record(STAT_ADC_SCANS, scans);
+    stats_record(STAT_ADC_FILTER_US, (acq_now_ns() - ts_ns) / 1000);
+
+    return 0;
+}
+
+static void *acq_thread(void *arg)
+{
+    struct iio_context *ctx;
+    struct iio_device *dev = NULL;
+    struct iio_buffer *buf = NULL;
+    bool active[ACQ_KIND_MAX];
+    bool buffered = false;
+    unsigned int i;
+    uint64_t next_ns = 0;
+    struct timespec next;
+    static int32_t val[ACQ_ADC_MAX][ACQ_BUF_SCANS];
+    bool valid[ACQ_ADC_MAX];
+    uint64_t ts_ns;
+    uint8_t modes;
+    long long raw;
+    bool pushed;
+
+    /* Fine if it fails or already exists, see acq_trigger_setup(). One left
+     * from a previous run, see acq_trigger_remove(), is simply reused.
+     */
+    acq_trig_created = (mkdir(ACQ_TRIG_DIR, 0755) == 0);
+
+    /* IIO setup, done here so context creation doesn't hold up the UI */
+    ctx = iio_create_default_context();
+    if (ctx != NULL)
+        dev = iio_context_find_device(ctx, ACQ_ADC_DEV);
+    for (i = 0; i < acq_adc_cnt; i++) {
+        if (dev != NULL)
+            acq_adc[i].iio_chan = iio_device_find_channel(dev,
+              acq_adc[i].chan_name, false);
+        acq_adc_cal_setup(&acq_adc[i]);
+    }
+    if (dev != NULL)
+        buffered = acq_trigger_setup(ctx, dev);
+    if (!buffered)
+        acq_trigger_remove(dev);
+
+    while (1) {
+        pthread_mutex_lock(&acq_lock);
+        if (!acq_active[ACQ_ADC] && buf == NULL) {
+            while (!acq_active[ACQ_ADC])
+                pthread_cond_wait(&acq_cond, &acq_lock);
+            /* Start a fresh schedule rather than catching up */
+            next_ns = 0;
+        }
+        for (i = 0; i < ACQ_KIND_MAX; i++)
+            active[i] = acq_active[i];
+        pthread_mutex_unlock(&acq_lock);
+
+        /* Stop the capture while nothing is showing it */
+        if (!active[ACQ_ADC]) {
+            acq_buf_close(buf);
+            buf = NULL;
+            continue;
+        }
+
+        /* Buffered capture where the ADC and kernel support it, the refill
+         * paces the loop. Any failure drops back to polling sysfs for good.
+         */
+        if (buffered && buf == NULL) {
+            buf = acq_buf_open(dev);
+            buffered = (buf != NULL);
+            if (buf != NULL)
+                acq_dsp_init(true);
+            else
+                acq_trigger_remove(dev);
+        }
+        if (buf != NULL) {
+            pushed = false;
+            if (acq_buf_read(buf, &pushed) == -1) {
+                perror("ADC buffer, polling instead");
+                acq_buf_close(buf);
+                acq_trigger_remove(dev);
+                buf = NULL;
+                buffered = false;
+                next_ns = 0;
+            }
+            if (pushed)
+                loop_efd_signal(acq_event_fd);
+            continue;
+        }
+
+        if (next_ns == 0) {
+            next_ns = acq_now_ns();
+            acq_dsp_init(false);
+        }
+
+        pushed = false;
+        modes = 0;
+
+        if (active[ACQ_ADC]) {
+            for (i = 0; i < acq_adc_cnt; i++) {
+                valid[i] = acq_adc[i].iio_chan != NULL &&
+                  iio_channel_attr_read_longlong(acq_adc[i].iio_chan, "raw",
+                  &raw) >= 0;
+                if (!valid[i])
+                    continue;
+                val[i][0] = raw;
+                cal_apply(acq_adc_conv(i, &modes), val[i], val[i], 1);
+            }
+            ts_ns = acq_now_ns();
+            acq_log(val, valid, 1, ts_ns, ACQ_PERIOD_NS, modes);
+            pushed = acq_dsp_run(val, valid, 1, ts_ns, 0);
+        }
+
+        /* One wakeup of the UI per batch, eventfd coalesces anything more */
+        if (pushed)
+            loop_efd_signal(acq_event_fd);
+
+        /* Absolute deadlines so the cadence holds regardless of how long
+         * the reads above took.
+         */
+        next_ns += ACQ_PERIOD_NS;
+        next.tv_sec = next_ns / 1000000000ULL;
+        next.tv_nsec = next_ns % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) ==
+          EINTR);
+    }
+
+    return NULL;
+}
+
+/* Drain everything available, once per main loop wakeup */
+static void acq_drain(int fd, uint32_t events, void *user_data)
+{
+    struct acq_sample sample;
+
+    loop_efd_drain(fd);
+
+    while (ring_pop(&acq_ring, &sample)) {
+        if (acq_cb[sample.kind] != NULL)
+            acq_cb[sample.kind](&sample);
+    }
+}
+
+int acq_start(void)
+{
+    pthread_t thread;
+
+    if (ring_init(&acq_ring, ACQ_RING_SLOTS, sizeof(struct acq_sample)) == -1)
+        return -1;
+
+    acq_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (acq_event_fd == -1)
+        goto out_ring;
+
+    if (loop_add_fd(acq_event_fd, EPOLLIN, acq_drain, NULL) == -1)
+        goto out_fd;
+
+    if (pthread_create(&thread, NULL, acq_thread, NULL) != 0)
+        goto out_loop;
+    pthread_setname_np(thread, "acq");
+    pthread_detach(thread);
+
+    return 0;
+
+out_loop:
+    loop_del_fd(acq_event_fd);
+out_fd:
+    close(acq_event_fd);
+    acq_event_fd = -1;
+out_ring:
+    ring_free(&acq_ring);
+    return -1;
+}
@@ -0,0 +1,82 @@
+#ifndef __ACQ_H__
+#define __ACQ_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dsp.h"
+
+/* The acquisition thread owns the IIO handles. It samples them on its own
+ * schedule and publishes timestamped samples through a lock-free ring that the
+ * UI thread drains from the main loop. A slow read never stalls rendering, and
+ * a long render never delays sampling.
+ *
+ * Where the kernel allows, the ADC channels are captured together into an IIO
+ * buffer by a 1 kHz trigger, and each batch is read with a single refill.
+ * Otherwise each channel's sysfs "raw" attribute is polled, every 100 ms.
+ *
+ * Either way, the channels are run through a dsp.h filter chain before they
+ * are published, so the UI only sees clean values at a low rate. Buffered
+ * capture is decimated by 64 on the way, to a sample every 64 ms.
+ */
+
+enum acq_kind {
+    ACQ_ADC,        /* value is in mV, or uA in current mode */
+    ACQ_KIND_MAX,
+};
+
+/* What the ADC front end is set up to measure, see gpio_adc_setup() */
+enum acq_adc_mode {
+    ACQ_ADC_VOLTAGE,
+    ACQ_ADC_CURRENT,
+    ACQ_ADC_MODE_MAX,
+};
+
+/* Calibration of one mode of a channel, from mV at the ADC to the units of
+ * the input. Samples are converted a whole buffer at a time with cal.h, with
+ * the channel's IIO scale and offset folded in.
+ */
+struct acq_adc_cal {
+    double gain;
+    double bias;
+};
+
+struct acq_sample {
+    uint64_t ts_ns;     /* CLOCK_MONOTONIC time the sample was taken */
+    uint8_t kind;
+    uint8_t chan;       /* index returned by acq_adc_add() */
+    int32_t value;
+};
+
+/* Called on the UI thread, LVGL calls are safe from inside the callback */
+typedef void (*acq_cb_t)(const struct acq_sample *sample);
+
+void acq_set_cb(enum acq_kind kind, acq_cb_t cb);
+
+/* Add a channel of the ADC device to be sampled, with a calibration for each
+ * mode and the channel's settings for the filter chain, which must both stay
+ * around. Must be called before acq_start(). Returns the channel index used
+ * in samples, or -1 on error.
+ */
+int acq_adc_add(const char *chan_name, const struct acq_adc_cal *cal,
+  const struct dsp_chan_cfg *filter);
+
+/* Switch the calibration a channel's samples are converted with. Safe from
+ * any thread, it takes effect from the next batch.
+ */
+void acq_adc_set_mode(int chan, enum acq_adc_mode mode);
+
+/* Sample a kind of input only while something is showing it */
+void acq_set_active(enum acq_kind kind, bool active);
+
+/* Hand samples of a kind to its callback, and so wake the UI thread for them,
+ * only while something on screen is showing each one. ADC samples go into
+ * the hist.h history by channel index regardless, from the acquisition thread.
+ */
+void acq_set_notify(enum acq_kind kind, bool notify);
+
+/* Start the acquisition thread and register its wakeup fd with the main loop.
+ * Returns -1 on error.
+ */
+int acq_start(void);
+
+#endif // __ACQ_H__
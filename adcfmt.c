@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "adcfmt.h"
+
+/* Most bytes one sample's varint can take */
+#define ADCFMT_VARINT_MAX 5
+
+/* The CRC covers the header from seq on, then the scans */
+#define ADCFMT_CRC_FROM offsetof(struct adcfmt_hdr, seq)
+
+/* CRC-32 as in zlib and Ethernet, a nibble at a time. Plenty fast for a
+ * few kB a second and keeps the table small.
+ */
+static const uint32_t adcfmt_crc_tab[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+bool adcfmt_seg_parse(const char *name, unsigned int *seg)
+{
+    char check[32];
+    int len = -1;
+
+    if (sscanf(name, "adc-%8u.log%n", seg, &len) != 1 || len == -1 ||
+      name[len] != '\0')
+        return false;
+
+    /* Exactly as written, not e.g. adc-1.log */
+    snprintf(check, sizeof(check), ADCFMT_SEG_NAME, *seg);
+    return strcmp(check, name) == 0;
+}
+
+uint32_t adcfmt_crc32(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ adcfmt_crc_tab[crc & 0xf];
+        crc = (crc >> 4) ^ adcfmt_crc_tab[crc & 0xf];
+    }
+
+    return ~crc;
+}
+
+void adcfmt_begin(struct adcfmt_block *blk, uint32_t seq, uint64_t t0_ns,
+  uint32_t period_ns, unsigned int chans, uint8_t valid, uint8_t modes)
+{
+    unsigned int i;
+
+    memset(&blk->hdr, 0, sizeof(blk->hdr));
+    blk->hdr.seq = seq;
+    blk->hdr.t0_ns = t0_ns;
+    blk->hdr.period_ns = period_ns;
+    blk->hdr.chans = (chans > ADCFMT_CHAN_MAX) ? ADCFMT_CHAN_MAX : chans;
+    blk->hdr.valid = valid;
+    blk->hdr.modes = modes;
+    for (i = 0; i < ADCFMT_CHAN_MAX; i++) {
+        blk->hdr.min[i] = INT32_MAX;
+        blk->hdr.max[i] = INT32_MIN;
+    }
+}
+
+bool adcfmt_put(struct adcfmt_block *blk, const int32_t *scan)
+{
+    struct adcfmt_hdr *hdr = &blk->hdr;
+    uint8_t *p = blk->data + hdr->used;
+    uint32_t z;
+    unsigned int i;
+
+    if (hdr->used + (size_t)(hdr->chans * ADCFMT_VARINT_MAX) >
+      sizeof(blk->data) || hdr->scans == UINT16_MAX)
+        return false;
+
+    for (i = 0; i < hdr->chans; i++) {
+        /* Wraps rather than overflows, decoding wraps it back */
+        z = (uint32_t)scan[i] - (uint32_t)hdr->last[i];
+        z = (z << 1) ^ -(z >> 31);
+        while (z >= 0x80) {
+            *p++ = z | 0x80;
+            z >>= 7;
+        }
+        *p++ = z;
+
+        hdr->last[i] = scan[i];
+        hdr->sum[i] += scan[i];
+        if (scan[i] < hdr->min[i])
+            hdr->min[i] = scan[i];
+        if (scan[i] > hdr->max[i])
+            hdr->max[i] = scan[i];
+    }
+
+    hdr->used = p - blk->data;
+    hdr->scans++;
+
+    return true;
+}
+
+static uint32_t adcfmt_block_crc(const struct adcfmt_block *blk)
+{
+    return adcfmt_crc32(0, (const uint8_t *)blk + ADCFMT_CRC_FROM,
+      sizeof(blk->hdr) - ADCFMT_CRC_FROM + blk->hdr.used);
+}
+
+void adcfmt_commit(struct adcfmt_block *blk)
+{
+    blk->hdr.magic = ADCFMT_MAGIC;
+    blk->hdr.version = ADCFMT_VERSION;
+    blk->hdr.crc = adcfmt_block_crc(blk);
+}
+
+bool adcfmt_check(const struct adcfmt_block *blk)
+{
+    const struct adcfmt_hdr *hdr = &blk->hdr;
+
+    return hdr->magic == ADCFMT_MAGIC && hdr->version == ADCFMT_VERSION &&
+      hdr->used <= sizeof(blk->data) && hdr->chans <= ADCFMT_CHAN_MAX &&
+      hdr->crc == adcfmt_block_crc(blk);
+}
+
+int adcfmt_decode(const struct adcfmt_block *blk,
+  int32_t (*out)[ADCFMT_CHAN_MAX])
+{
+    const struct adcfmt_hdr *hdr = &blk->hdr;
+    const uint8_t *p = blk->data, *end = blk->data + hdr->used;
+    uint32_t prev[ADCFMT_CHAN_MAX] = { 0 };
+    uint32_t z;
+    unsigned int s, i, shift;
+
+    for (s = 0; s < hdr->scans; s++) {
+        for (i = 0; i < hdr->chans; i++) {
+            z = 0;
+            shift = 0;
+            do {
+                if (p == end || shift > 28)
+                    return -1;
+                z |= (uint32_t)(*p & 0x7f) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+
+            prev[i] += (z >> 1) ^ -(z & 1);
+            out[s][i] = prev[i];
+        }
+        for (; i < ADCFMT_CHAN_MAX; i++)
+            out[s][i] = 0;
+    }
+
+    return (p == end) ? (int)hdr->scans : -1;
+}
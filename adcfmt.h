@@ -0,0 +1,87 @@
+#ifndef __ADCFMT_H__
+#define __ADCFMT_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* On-disk format of the ADC log, see adclog.h. A log is a directory of
+ * segment files, each a whole number of ADCFMT_BLOCK sized blocks. Every
+ * block stands on its own: a header with the time of its first scan, the
+ * scan period, and a summary of each channel over the block, then the
+ * scans themselves. A block can be checked and decoded without reading any
+ * other, and its header alone is enough to skip it or to answer min, max,
+ * and mean over it.
+ *
+ * Scans are stored channel by channel, each sample as the zigzag varint of
+ * its difference from the channel's previous sample in the block, starting
+ * from 0. Scan i of a block was taken at t0_ns + (i * period_ns).
+ *
+ * Everything is little endian, the same as the hardware writing it.
+ */
+#define ADCFMT_MAGIC 0x4c434441     /* "ADCL" */
+#define ADCFMT_VERSION 1
+
+#define ADCFMT_BLOCK 4096
+#define ADCFMT_CHAN_MAX 4
+
+/* Segment files are named by number, e.g. adc-00000042.log */
+#define ADCFMT_SEG_NAME "adc-%08u.log"
+
+/* adcq caches its index of a segment next to it, which goes with it */
+#define ADCFMT_IDX_NAME "adc-%08u.idx"
+
+struct adcfmt_hdr {
+    uint32_t magic;
+    uint32_t crc;               /* CRC-32 from seq to the end of the scans */
+    uint32_t seq;               /* segment number * blocks per segment + index */
+    uint16_t used;              /* bytes of scans */
+    uint16_t scans;
+    uint64_t t0_ns;             /* CLOCK_REALTIME */
+    uint32_t period_ns;
+    uint8_t chans;
+    uint8_t valid;              /* bit per channel actually sampled */
+    uint8_t modes;              /* bit per channel in uA rather than mV */
+    uint8_t version;
+    int32_t min[ADCFMT_CHAN_MAX];
+    int32_t max[ADCFMT_CHAN_MAX];
+    int32_t last[ADCFMT_CHAN_MAX];
+    int64_t sum[ADCFMT_CHAN_MAX];
+};
+
+struct adcfmt_block {
+    struct adcfmt_hdr hdr;
+    uint8_t data[ADCFMT_BLOCK - sizeof(struct adcfmt_hdr)];
+};
+
+_Static_assert(sizeof(struct adcfmt_block) == ADCFMT_BLOCK,
+  "ADC log blocks must be exactly ADCFMT_BLOCK");
+
+/* Returns false unless `name` is a segment file, see ADCFMT_SEG_NAME */
+bool adcfmt_seg_parse(const char *name, unsigned int *seg);
+
+uint32_t adcfmt_crc32(uint32_t crc, const void *buf, size_t len);
+
+/* Start an empty block, in memory, of `chans` channels */
+void adcfmt_begin(struct adcfmt_block *blk, uint32_t seq, uint64_t t0_ns,
+  uint32_t period_ns, unsigned int chans, uint8_t valid, uint8_t modes);
+
+/* Append a scan of the block's channels. Returns false if the block is too
+ * full to be sure of fitting it, the scan isn't added then.
+ */
+bool adcfmt_put(struct adcfmt_block *blk, const int32_t *scan);
+
+/* Stamp the magic and CRC, after which the block is valid as it stands. It
+ * can still be added to, and committed again.
+ */
+void adcfmt_commit(struct adcfmt_block *blk);
+
+/* Returns false unless the block is committed and intact */
+bool adcfmt_check(const struct adcfmt_block *blk);
+
+/* Decode a checked block's scans into `out`, which needs room for
+ * hdr.scans of them. Returns -1 if the scans don't match the header.
+ */
+int adcfmt_decode(const struct adcfmt_block *blk,
+  int32_t (*out)[ADCFMT_CHAN_MAX]);
+
+#endif // __ADCFMT_H__
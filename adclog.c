@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+
+#include "adcfmt.h"
+#include "adclog.h"
+#include "loop.h"
+#include "ring.h"
+#include "stats.h"
+
+#define ADCLOG_SEG_BLOCKS (ADCLOG_SEG_BYTES / ADCFMT_BLOCK)
+#define ADCLOG_SYNC_NS (ADCLOG_SYNC_MS * 1000000ULL)
+
+/* Most scans in one hand over, and how many hand overs the ring holds:
+ * several seconds of 1 kHz capture, should a sync take a while. The logger
+ * is only woken once ADCLOG_WAKE of them are waiting, or to sync.
+ */
+#define ADCLOG_BATCH 100
+#define ADCLOG_RING_SLOTS 64
+#define ADCLOG_WAKE 8
+
+/* Scans that don't follow on from the block being filled to within this,
+ * e.g. after capture was stopped for a while, start a new block.
+ */
+#define ADCLOG_JITTER_NS (20 * 1000000ULL)
+
+struct adclog_batch {
+    uint64_t ts_ns;         /* CLOCK_MONOTONIC of the last scan */
+    uint32_t period_ns;
+    uint16_t scans;
+    uint8_t chans;
+    uint8_t valid;
+    uint8_t modes;
+    int32_t scan[ADCLOG_BATCH][ADCFMT_CHAN_MAX];
+};
+
+static struct ring adclog_ring;
+static int adclog_event_fd = -1;
+static atomic_bool adclog_on;
+
+/* Everything below is only touched by the logger thread */
+static int adclog_dir_fd = -1;
+
+/* Most segments kept, see adclog_seg_cap() */
+static unsigned int adclog_seg_max;
+
+/* Oldest segment, and the one being written with its mapping */
+static unsigned int adclog_seg_first;
+static unsigned int adclog_seg;
+static uint8_t *adclog_map;
+
+/* The block being filled, in memory, and its index in the segment */
+static struct adcfmt_block adclog_blk;
+static unsigned int adclog_idx;
+static bool adclog_open;
+static uint64_t adclog_t0_mono;
+
+/* Blocks copied into the mapping since the last sync */
+static bool adclog_dirty;
+static unsigned int adclog_dirty_from, adclog_dirty_to;
+
+static uint64_t adclog_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static struct adcfmt_block *adclog_slot(unsigned int idx)
+{
+    return (struct adcfmt_block *)(adclog_map + ((size_t)idx * ADCFMT_BLOCK));
+}
+
+static int adclog_seg_open(unsigned int seg, bool create)
+{
+    char name[32];
+    uint8_t *map;
+    int fd, err;
+
+    snprintf(name, sizeof(name), ADCFMT_SEG_NAME, seg);
+    fd = openat(adclog_dir_fd, name,
+      O_RDWR | O_CLOEXEC | (create ? (O_CREAT | O_EXCL) : 0), 0644);
+    if (fd == -1)
+        return -1;
+
+    /* All of it up front, so the segment is laid out in one go and a full
+     * filesystem shows up here rather than as a SIGBUS on a write.
+     */
+    err = posix_fallocate(fd, 0, ADCLOG_SEG_BYTES);
+    if (err != 0) {
+        close(fd);
+        /* Leave nothing behind for the retry, see adclog_seg_next() */
+        if (create)
+            unlinkat(adclog_dir_fd, name, 0);
+        errno = err;
+        return -1;
+    }
+
+    map = mmap(NULL, ADCLOG_SEG_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    /* So that the new file itself survives a power cut */
+    if (create)
+        fsync(adclog_dir_fd);
+
+    adclog_map = map;
+    adclog_seg = seg;
+
+    return 0;
+}
+
+/* Blocks are only ever written in order, so the ones committed are a prefix
+ * of the segment. Returns the index of the first block after them, which
+ * is where writing carries on.
+ */
+static unsigned int adclog_recover(void)
+{
+    unsigned int lo = 0, hi = ADCLOG_SEG_BLOCKS, mid;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (adclog_slot(mid)->hdr.magic == ADCFMT_MAGIC)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* The last may have been torn by a power cut part way through */
+    if (lo > 0 && !adcfmt_check(adclog_slot(lo - 1)))
+        lo--;
+
+    return lo;
+}
+
+/* How many segments to keep: half of what the log's filesystem has room
+ * for, counting the segments already there, so the log can't fill it and
+ * starve the rest of the system. Never more than ADCLOG_SEG_MAX, and never
+ * fewer than 2 so there's always a whole segment behind the one being
+ * written.
+ */
+static unsigned int adclog_seg_cap(unsigned int segs)
+{
+    struct statvfs st;
+    uint64_t room;
+
+    if (fstatvfs(adclog_dir_fd, &st) == -1)
+        return ADCLOG_SEG_MAX;
+
+    room = ((uint64_t)st.f_bavail * st.f_frsize) / ADCLOG_SEG_BYTES;
+    room = (room + segs) / 2;
+    if (room > ADCLOG_SEG_MAX)
+        return ADCLOG_SEG_MAX;
+    if (room < 2)
+        return 2;
+    return room;
+}
+
+static void adclog_seg_drop(void)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), ADCFMT_SEG_NAME, adclog_seg_first);
+    unlinkat(adclog_dir_fd, name, 0);
+    snprintf(name, sizeof(name), ADCFMT_IDX_NAME, adclog_seg_first++);
+    unlinkat(adclog_dir_fd, name, 0);
+}
+
+/* Move on to a new segment. The oldest are deleted first to make room for
+ * it, and should the filesystem still be full, more of them until it fits.
+ */
+static int adclog_seg_next(void)
+{
+    unsigned int seg = adclog_seg + 1;
+
+    munmap(adclog_map, ADCLOG_SEG_BYTES);
+    adclog_map = NULL;
+
+    while (seg - adclog_seg_first >= adclog_seg_max)
+        adclog_seg_drop();
+
+    while (adclog_seg_open(seg, true) == -1) {
+        if (errno != ENOSPC || adclog_seg_first >= adclog_seg)
+            return -1;
+        adclog_seg_drop();
+    }
+    adclog_idx = 0;
+
+    return 0;
+}
+
+/* Pick up the newest segment where it left off, or start the first */
+static int adclog_seg_find(void)
+{
+    struct dirent *ent;
+    unsigned int seg, first = UINT32_MAX, last = 0;
+    bool found = false;
+    DIR *dir;
+    int fd;
+
+    fd = dup(adclog_dir_fd);
+    if (fd == -1)
+        return -1;
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (!adcfmt_seg_parse(ent->d_name, &seg))
+            continue;
+        found = true;
+        if (seg < first)
+            first = seg;
+        if (seg > last)
+            last = seg;
+    }
+    closedir(dir);
+
+    if (!found) {
+        adclog_seg_max = adclog_seg_cap(0);
+        adclog_seg_first = 0;
+        adclog_idx = 0;
+        return adclog_seg_open(0, true);
+    }
+
+    adclog_seg_max = adclog_seg_cap(last - first + 1);
+    adclog_seg_first = first;
+    if (adclog_seg_open(last, false) == -1)
+        return -1;
+
+    adclog_idx = adclog_recover();
+    if (adclog_idx == ADCLOG_SEG_BLOCKS)
+        return adclog_seg_next();
+
+    return 0;
+}
+
+/* Commit the block being filled and copy it into the mapping as it stands */
+static void adclog_store(void)
+{
+    adcfmt_commit(&adclog_blk);
+    memcpy(adclog_slot(adclog_idx), &adclog_blk, sizeof(adclog_blk));
+
+    if (!adclog_dirty)
+        adclog_dirty_from = adclog_idx;
+    adclog_dirty_to = adclog_idx;
+    adclog_dirty = true;
+}
+
+static void adclog_sync(void)
+{
+    uint64_t start = stats_now_us();
+    size_t len;
+
+    if (adclog_open && adclog_blk.hdr.scans > 0)
+        adclog_store();
+    if (!adclog_dirty)
+        return;
+
+    len = (size_t)(adclog_dirty_to - adclog_dirty_from + 1) * ADCFMT_BLOCK;
+    if (msync(adclog_slot(adclog_dirty_from), len, MS_SYNC) == -1)
+        perror("ADC log sync");
+    adclog_dirty = false;
+
+    stats_record(STAT_LOG_SYNC_US, stats_now_us() - start);
+}
+
+/* Finish the block being filled, moving on to the next segment if that was
+ * the last block of this one. Returns -1 on error.
+ */
+static int adclog_seal(void)
+{
+    if (!adclog_open)
+        return 0;
+    adclog_open = false;
+    if (adclog_blk.hdr.scans == 0)
+        return 0;
+
+    adclog_store();
+    if (++adclog_idx < ADCLOG_SEG_BLOCKS)
+        return 0;
+
+    adclog_sync();
+    return adclog_seg_next();
+}
+
+static bool adclog_follows(const struct adclog_batch *b, uint64_t mono)
+{
+    const struct adcfmt_hdr *hdr = &adclog_blk.hdr;
+    uint64_t expect;
+
+    if (hdr->period_ns != b->period_ns || hdr->chans != b->chans ||
+      hdr->valid != b->valid || hdr->modes != b->modes)
+        return false;
+
+    expect = adclog_t0_mono + (hdr->scans * (uint64_t)hdr->period_ns);
+    return mono + ADCLOG_JITTER_NS >= expect &&
+      mono <= expect + ADCLOG_JITTER_NS;
+}
+
+static int adclog_batch(const struct adclog_batch *b)
+{
+    uint64_t mono, real_off;
+    unsigned int s;
+
+    for (s = 0; s < b->scans; s++) {
+        mono = b->ts_ns - ((b->scans - 1 - s) * (uint64_t)b->period_ns);
+
+        if (adclog_open && (!adclog_follows(b, mono) ||
+          !adcfmt_put(&adclog_blk, b->scan[s]))) {
+            if (adclog_seal() == -1)
+                return -1;
+        }
+        if (adclog_open)
+            continue;
+
+        /* Blocks are timestamped with the wall clock, for whoever reads the
+         * log back, worked out afresh for each block.
+         */
+        real_off = adclog_now_ns(CLOCK_REALTIME) -
+          adclog_now_ns(CLOCK_MONOTONIC);
+        adcfmt_begin(&adclog_blk,
+          (adclog_seg * ADCLOG_SEG_BLOCKS) + adclog_idx, mono + real_off,
+          b->period_ns, b->chans, b->valid, b->modes);
+        adclog_t0_mono = mono;
+        adclog_open = true;
+        adcfmt_put(&adclog_blk, b->scan[s]);
+    }
+
+    return 0;
+}
+
+static void *adclog_thread(void *arg)
+{
+    static struct adclog_batch batch;
+    struct pollfd pfd = { .fd = adclog_event_fd, .events = POLLIN };
+    uint64_t now, next_sync, start;
+
+    /* Recovery reads the newest segment, done here so it can't hold up the
+     * UI. Anything pushed meanwhile waits in the ring.
+     */
+    if (adclog_seg_find() == -1)
+        goto out;
+
+    next_sync = adclog_now_ns(CLOCK_MONOTONIC) + ADCLOG_SYNC_NS;
+    while (1) {
+        now = adclog_now_ns(CLOCK_MONOTONIC);
+        poll(&pfd, 1, (next_sync > now) ?
+          (int)((next_sync - now + 999999) / 1000000) : 0);
+        loop_efd_drain(adclog_event_fd);
+
+        while (ring_pop(&adclog_ring, &batch)) {
+            start = stats_now_us();
+            if (adclog_batch(&batch) == -1)
+                goto out;
+            stats_record(STAT_LOG_ENCODE_US, stats_now_us() - start);
+        }
+
+        now = adclog_now_ns(CLOCK_MONOTONIC);
+        if (now >= next_sync) {
+            adclog_sync();
+            next_sync = now + ADCLOG_SYNC_NS;
+        }
+    }
+
+out:
+    perror("ADC log, stopped");
+    atomic_store(&adclog_on, false);
+    return NULL;
+}
+
+void adclog_push(const int32_t *const *chan, unsigned int chans,
+  unsigned int scans, uint64_t ts_ns, uint32_t period_ns, uint8_t valid,
+  uint8_t modes)
+{
+    /* Only ever the acquisition thread, and far too big for its stack */
+    static struct adclog_batch b;
+    unsigned int done, n, s, i;
+
+    if (!atomic_load_explicit(&adclog_on, memory_order_relaxed))
+        return;
+
+    if (chans > ADCFMT_CHAN_MAX)
+        chans = ADCFMT_CHAN_MAX;
+
+    for (done = 0; done < scans; done += n) {
+        n = scans - done;
+        if (n > ADCLOG_BATCH)
+            n = ADCLOG_BATCH;
+
+        b.ts_ns = ts_ns - ((scans - done - n) * (uint64_t)period_ns);
+        b.period_ns = period_ns;
+        b.scans = n;
+        b.chans = chans;
+        b.valid = valid;
+        b.modes = modes;
+        for (s = 0; s < n; s++) {
+            for (i = 0; i < chans; i++)
+                b.scan[s][i] = chan[i][done + s];
+        }
+
+        if (!ring_push(&adclog_ring, &b))
+            stats_record(STAT_LOG_LOST, n);
+        else if (ring_count(&adclog_ring) >= ADCLOG_WAKE)
+            loop_efd_signal(adclog_event_fd);
+    }
+}
+
+int adclog_start(const char *dir)
+{
+    pthread_t thread;
+
+    adclog_dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (adclog_dir_fd == -1)
+        return -1;
+
+    if (ring_init(&adclog_ring, ADCLOG_RING_SLOTS,
+      sizeof(struct adclog_batch)) == -1)
+        goto out_dir;
+
+    adclog_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (adclog_event_fd == -1)
+        goto out_ring;
+
+    atomic_store(&adclog_on, true);
+    if (pthread_create(&thread, NULL, adclog_thread, NULL) != 0)
+        goto out_fd;
+    pthread_setname_np(thread, "adclog");
+    pthread_detach(thread);
+
+    return 0;
+
+out_fd:
+    atomic_store(&adclog_on, false);
+    close(adclog_event_fd);
+    adclog_event_fd = -1;
+out_ring:
+    ring_free(&adclog_ring);
+out_dir:
+    close(adclog_dir_fd);
+    adclog_dir_fd = -1;
+    return -1;
+}
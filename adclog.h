@@ -0,0 +1,35 @@
+#ifndef __ADCLOG_H__
+#define __ADCLOG_H__
+#include <stdint.h>
+
+/* Logs every calibrated ADC sample, before any filtering, to a directory of
+ * preallocated segment files in the adcfmt.h format. The acquisition thread
+ * only copies each batch into a lock-free ring, a thread of the logger's own
+ * encodes them into blocks in memory, copies finished blocks into the
+ * mmap()ed segment, and msync()s what changed every ADCLOG_SYNC_MS. The
+ * block being filled is committed at each sync too, so at most that much is
+ * lost to a power cut, and flash sees a batch of whole pages every few
+ * seconds rather than a write per sample.
+ *
+ * On start, the newest segment is picked up where its last intact block
+ * ends. The log keeps to half of the room its filesystem has, and to at most
+ * ADCLOG_SEG_MAX segments, deleting the oldest before starting a new one.
+ */
+#define ADCLOG_SYNC_MS 10000
+#define ADCLOG_SEG_BYTES (16 * 1024 * 1024)
+#define ADCLOG_SEG_MAX 256
+
+/* Start logging into `dir`, which must exist. Returns -1 on error. */
+int adclog_start(const char *dir);
+
+/* From the acquisition thread, `scans` scans of `chans` channels, `chan[i]`
+ * being channel i's samples. `ts_ns` is when the last scan was taken, on
+ * CLOCK_MONOTONIC, `valid` and `modes` are as in struct adcfmt_hdr. Never
+ * blocks, if the logger has fallen behind the scans are dropped. A no-op
+ * unless the logger was started.
+ */
+void adclog_push(const int32_t *const *chan, unsigned int chans,
+  unsigned int scans, uint64_t ts_ns, uint32_t period_ns, uint8_t valid,
+  uint8_t modes);
+
+#endif // __ADCLOG_H__
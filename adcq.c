@@ -0,0 +1,952 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "adcfmt.h"
+
+/* Queries and export of an ADC log written with `-l`, see adcfmt.h.
+ *
+ * Each segment gets an index cached next to it, adc-NNNNNNNN.idx: a summary
+ * of the whole segment, then a copy of the header of each of its intact
+ * blocks. The headers are all it takes to find blocks by time and to answer
+ * min, max, and mean over whole blocks, at 112 bytes per 4 kB block, and the
+ * summary is enough to skip, or answer for, a whole segment. Only blocks
+ * that straddle the ends of the range, or that a threshold falls inside,
+ * are read and decoded. Indexes are built the first time a segment is
+ * queried, and only extended for the segment still being written.
+ */
+#define ADCQ_IDX_MAGIC 0x49434441   /* "ADCI" */
+#define ADCQ_IDX_VERSION 2
+
+/* Blocks read at a time while indexing a segment */
+#define ADCQ_READ_BLOCKS 64
+
+/* Most scans a block can hold, at a byte per sample */
+#define ADCQ_SCANS_MAX (sizeof(((struct adcfmt_block *)0)->data))
+
+#define ADCQ_COL_MAGIC "ADCQCOL1"
+
+struct adcq_sum {
+    uint64_t n[ADCFMT_CHAN_MAX];
+    int64_t sum[ADCFMT_CHAN_MAX];
+    int32_t min[ADCFMT_CHAN_MAX];
+    int32_t max[ADCFMT_CHAN_MAX];
+    uint8_t modes_any;      /* channels in uA anywhere, and everywhere */
+    uint8_t modes_all;
+};
+
+struct adcq_idx_hdr {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t complete;       /* the segment won't be written to again */
+    uint8_t sorted;         /* each block starts after the one before ends */
+    uint32_t blocks;
+    uint32_t blocks_max;    /* the segment's size in blocks */
+    uint64_t t_first;       /* first and last scan, CLOCK_REALTIME */
+    uint64_t t_last;
+    struct adcq_sum sum;
+};
+
+struct adcq_seg {
+    unsigned int num;
+    int fd;
+    struct adcq_idx_hdr ih;
+    struct adcfmt_hdr *blk;     /* the headers, once loaded */
+};
+
+enum adcq_dir {
+    ADCQ_RISE = 1 << 0,
+    ADCQ_FALL = 1 << 1,
+};
+
+static struct adcq_seg *adcq_seg;
+static unsigned int adcq_seg_cnt;
+static int adcq_dir_fd = -1;
+
+/* The range and channels asked for, times are inclusive of `from` only */
+static uint64_t adcq_from;
+static uint64_t adcq_to = UINT64_MAX;
+static uint8_t adcq_chans = (1U << ADCFMT_CHAN_MAX) - 1;
+
+/* What it took, to show how little was read */
+static unsigned int adcq_n_seg_sum, adcq_n_blk_sum, adcq_n_decoded;
+
+static uint64_t adcq_blk_last(const struct adcfmt_hdr *hdr)
+{
+    return hdr->t0_ns + ((hdr->scans - 1) * (uint64_t)hdr->period_ns);
+}
+
+static bool adcq_chan_ok(uint8_t valid, unsigned int chans, unsigned int c)
+{
+    return c < chans && (valid & adcq_chans & (1U << c));
+}
+
+static void adcq_sum_init(struct adcq_sum *s)
+{
+    unsigned int c;
+
+    memset(s, 0, sizeof(*s));
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        s->min[c] = INT32_MAX;
+        s->max[c] = INT32_MIN;
+    }
+    s->modes_all = 0xff;
+}
+
+static void adcq_sum_merge(struct adcq_sum *s, const struct adcq_sum *o)
+{
+    unsigned int c;
+
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        if (o->n[c] == 0)
+            continue;
+        s->n[c] += o->n[c];
+        s->sum[c] += o->sum[c];
+        if (o->min[c] < s->min[c])
+            s->min[c] = o->min[c];
+        if (o->max[c] > s->max[c])
+            s->max[c] = o->max[c];
+    }
+    s->modes_any |= o->modes_any;
+    s->modes_all &= o->modes_all;
+}
+
+/* A block's own summary, in the same form as a segment's */
+static void adcq_sum_blk(struct adcq_sum *s, const struct adcfmt_hdr *hdr)
+{
+    unsigned int c;
+
+    adcq_sum_init(s);
+    for (c = 0; c < hdr->chans; c++) {
+        if (!(hdr->valid & (1U << c)))
+            continue;
+        s->n[c] = hdr->scans;
+        s->sum[c] = hdr->sum[c];
+        s->min[c] = hdr->min[c];
+        s->max[c] = hdr->max[c];
+    }
+    s->modes_any = s->modes_all = hdr->modes;
+}
+
+static int adcq_seg_cmp(const void *a, const void *b)
+{
+    const struct adcq_seg *sa = a, *sb = b;
+
+    return (sa->num > sb->num) - (sa->num < sb->num);
+}
+
+static int adcq_seg_fd(struct adcq_seg *seg)
+{
+    char name[32];
+
+    if (seg->fd == -1) {
+        snprintf(name, sizeof(name), ADCFMT_SEG_NAME, seg->num);
+        seg->fd = openat(adcq_dir_fd, name, O_RDONLY | O_CLOEXEC);
+    }
+
+    return seg->fd;
+}
+
+/* Write the index back for next time. Best effort, the log may well be on
+ * read-only media.
+ */
+static void adcq_idx_save(const struct adcq_seg *seg)
+{
+    char name[32], tmp[40];
+    size_t len = seg->ih.blocks * sizeof(struct adcfmt_hdr);
+    int fd;
+
+    snprintf(name, sizeof(name), ADCFMT_IDX_NAME, seg->num);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    fd = openat(adcq_dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      0644);
+    if (fd == -1)
+        return;
+
+    if (write(fd, &seg->ih, sizeof(seg->ih)) != sizeof(seg->ih) ||
+      (len > 0 && write(fd, seg->blk, len) != (ssize_t)len)) {
+        close(fd);
+        unlinkat(adcq_dir_fd, tmp, 0);
+        return;
+    }
+    close(fd);
+    renameat(adcq_dir_fd, tmp, adcq_dir_fd, name);
+}
+
+/* Just the summary from the cached index, if there is one that is still
+ * good. Returns -1 if not, and the index has to be loaded or built.
+ */
+static int adcq_idx_summary(struct adcq_seg *seg)
+{
+    struct stat st;
+    char name[32];
+    ssize_t n;
+    int fd;
+
+    snprintf(name, sizeof(name), ADCFMT_IDX_NAME, seg->num);
+    fd = openat(adcq_dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    n = read(fd, &seg->ih, sizeof(seg->ih));
+    close(fd);
+
+    if (n != sizeof(seg->ih) || seg->ih.magic != ADCQ_IDX_MAGIC ||
+      seg->ih.version != ADCQ_IDX_VERSION ||
+      seg->ih.blocks > seg->ih.blocks_max)
+        return -1;
+
+    /* Nor one left from a segment of another size */
+    if (adcq_seg_fd(seg) == -1 || fstat(seg->fd, &st) == -1 ||
+      seg->ih.blocks_max != st.st_size / ADCFMT_BLOCK)
+        return -1;
+
+    return 0;
+}
+
+/* Whether the blocks' times only go forward. The wall clock they are stamped
+ * with can be stepped back under the logger, e.g. by NTP, and then blocks
+ * can't be found by binary search.
+ */
+static bool adcq_blk_sorted(const struct adcq_seg *seg, unsigned int blocks)
+{
+    unsigned int i;
+
+    for (i = 1; i < blocks; i++) {
+        if (seg->blk[i].t0_ns < adcq_blk_last(&seg->blk[i - 1]))
+            return false;
+    }
+
+    return true;
+}
+
+/* Load the cached index, then read on from its last block, which may have
+ * been rewritten since, to the end of the segment's intact blocks. Returns
+ * -1 on error.
+ */
+static int adcq_idx_load(struct adcq_seg *seg, bool newest)
+{
+    static struct adcfmt_block chunk[ADCQ_READ_BLOCKS];
+    struct adcq_idx_hdr ih = { 0 };
+    struct adcq_sum s;
+    struct stat st;
+    char name[32];
+    unsigned int i, start, cnt, had, blocks_max;
+    uint32_t seq0;
+    ssize_t n;
+    int fd;
+
+    if (adcq_seg_fd(seg) == -1 || fstat(seg->fd, &st) == -1)
+        return -1;
+
+    blocks_max = st.st_size / ADCFMT_BLOCK;
+    free(seg->blk);
+    seg->blk = calloc(blocks_max ? blocks_max : 1, sizeof(*seg->blk));
+    if (seg->blk == NULL)
+        return -1;
+    seq0 = seg->num * blocks_max;
+
+    /* Whatever of the cached index still matches the segment. The index may
+     * have come along with a copied log, so nothing in it is trusted.
+     */
+    snprintf(name, sizeof(name), ADCFMT_IDX_NAME, seg->num);
+    fd = openat(adcq_dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        if (read(fd, &ih, sizeof(ih)) != sizeof(ih) ||
+          ih.magic != ADCQ_IDX_MAGIC || ih.version != ADCQ_IDX_VERSION ||
+          ih.blocks_max != blocks_max || ih.blocks > blocks_max)
+            memset(&ih, 0, sizeof(ih));
+        n = (ih.blocks > 0) ?
+          read(fd, seg->blk, ih.blocks * sizeof(*seg->blk)) : 0;
+        if (n != (ssize_t)(ih.blocks * sizeof(*seg->blk)))
+            memset(&ih, 0, sizeof(ih));
+        close(fd);
+    }
+    ih.blocks_max = blocks_max;
+    for (i = 0; i < ih.blocks; i++) {
+        if (seg->blk[i].seq != seq0 + i)
+            break;
+    }
+    had = i;
+
+    if (!(ih.complete && had == ih.blocks)) {
+        start = (had > 0) ? had - 1 : 0;
+        for (i = start; i < ih.blocks_max; i += cnt) {
+            cnt = ih.blocks_max - i;
+            if (cnt > ADCQ_READ_BLOCKS)
+                cnt = ADCQ_READ_BLOCKS;
+            n = pread(seg->fd, chunk, cnt * ADCFMT_BLOCK,
+              (off_t)i * ADCFMT_BLOCK);
+            if (n < ADCFMT_BLOCK)
+                break;
+            cnt = n / ADCFMT_BLOCK;
+
+            for (n = 0; n < (ssize_t)cnt; n++) {
+                if (!adcfmt_check(&chunk[n]) || chunk[n].hdr.seq != seq0 + i + n
+                  || chunk[n].hdr.scans == 0)
+                    break;
+                seg->blk[i + n] = chunk[n].hdr;
+            }
+            if (n < (ssize_t)cnt) {
+                i += n;
+                break;
+            }
+        }
+        ih.blocks = i;
+    }
+
+    /* The logger never goes back to a segment once it's on to the next */
+    ih.complete = !newest;
+    ih.sorted = adcq_blk_sorted(seg, ih.blocks);
+    ih.magic = ADCQ_IDX_MAGIC;
+    ih.version = ADCQ_IDX_VERSION;
+    adcq_sum_init(&ih.sum);
+    ih.t_first = UINT64_MAX;
+    ih.t_last = 0;
+    for (i = 0; i < ih.blocks; i++) {
+        adcq_sum_blk(&s, &seg->blk[i]);
+        adcq_sum_merge(&ih.sum, &s);
+        if (seg->blk[i].t0_ns < ih.t_first)
+            ih.t_first = seg->blk[i].t0_ns;
+        if (adcq_blk_last(&seg->blk[i]) > ih.t_last)
+            ih.t_last = adcq_blk_last(&seg->blk[i]);
+    }
+
+    if (memcmp(&ih, &seg->ih, sizeof(ih)) != 0 || ih.blocks != had) {
+        seg->ih = ih;
+        adcq_idx_save(seg);
+    }
+    seg->ih = ih;
+
+    return 0;
+}
+
+/* Find the segments and get each one's summary, from its cached index where
+ * it can. Returns -1 on error.
+ */
+static int adcq_open(const char *dir)
+{
+    struct dirent *ent;
+    struct adcq_seg *seg;
+    unsigned int num, i;
+    DIR *d;
+
+    adcq_dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (adcq_dir_fd == -1)
+        return -1;
+    d = fdopendir(dup(adcq_dir_fd));
+    if (d == NULL)
+        return -1;
+
+    while ((ent = readdir(d)) != NULL) {
+        if (!adcfmt_seg_parse(ent->d_name, &num))
+            continue;
+        seg = realloc(adcq_seg, (adcq_seg_cnt + 1) * sizeof(*seg));
+        if (seg == NULL) {
+            closedir(d);
+            return -1;
+        }
+        adcq_seg = seg;
+        memset(&adcq_seg[adcq_seg_cnt], 0, sizeof(*seg));
+        adcq_seg[adcq_seg_cnt].num = num;
+        adcq_seg[adcq_seg_cnt++].fd = -1;
+    }
+    closedir(d);
+
+    qsort(adcq_seg, adcq_seg_cnt, sizeof(*adcq_seg), adcq_seg_cmp);
+
+    for (i = 0; i < adcq_seg_cnt; i++) {
+        seg = &adcq_seg[i];
+        if (seg->blk == NULL && i + 1 < adcq_seg_cnt &&
+          adcq_idx_summary(seg) == 0 && seg->ih.complete)
+            continue;
+        if (adcq_idx_load(seg, i + 1 == adcq_seg_cnt) == -1) {
+            fprintf(stderr, ADCFMT_SEG_NAME ": %s\n", seg->num,
+              strerror(errno));
+            seg->ih.blocks = 0;
+        }
+    }
+
+    return 0;
+}
+
+static bool adcq_seg_overlaps(const struct adcq_seg *seg)
+{
+    return seg->ih.blocks > 0 && seg->ih.t_first < adcq_to &&
+      seg->ih.t_last >= adcq_from;
+}
+
+static bool adcq_seg_inside(const struct adcq_seg *seg)
+{
+    return seg->ih.t_first >= adcq_from && seg->ih.t_last < adcq_to;
+}
+
+static bool adcq_blk_inside(const struct adcfmt_hdr *hdr)
+{
+    return hdr->t0_ns >= adcq_from && adcq_blk_last(hdr) < adcq_to;
+}
+
+static bool adcq_blk_overlaps(const struct adcfmt_hdr *hdr)
+{
+    return hdr->t0_ns < adcq_to && adcq_blk_last(hdr) >= adcq_from;
+}
+
+/* First block of a loaded segment that ends at or after the range starts,
+ * for a sorted one only.
+ */
+static unsigned int adcq_blk_find(const struct adcq_seg *seg)
+{
+    unsigned int lo = 0, hi = seg->ih.blocks, mid;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (adcq_blk_last(&seg->blk[mid]) < adcq_from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Read and decode block `idx` of a segment, returns its scan count or -1 */
+static int adcq_blk_decode(struct adcq_seg *seg, unsigned int idx,
+  int32_t (*out)[ADCFMT_CHAN_MAX])
+{
+    static struct adcfmt_block blk;
+
+    adcq_n_decoded++;
+    if (pread(seg->fd, &blk, sizeof(blk), (off_t)idx * ADCFMT_BLOCK) !=
+      sizeof(blk) || !adcfmt_check(&blk))
+        return -1;
+
+    return adcfmt_decode(&blk, out);
+}
+
+/* Call `fn` for each block overlapping the range, with whether it's wholly
+ * inside. `seg_fn` is offered each whole segment inside first, and if it
+ * returns true the segment's blocks are skipped.
+ */
+static void adcq_walk(bool (*seg_fn)(struct adcq_seg *seg),
+  void (*fn)(struct adcq_seg *seg, unsigned int idx, bool inside))
+{
+    struct adcq_seg *seg;
+    unsigned int i, b;
+
+    for (i = 0; i < adcq_seg_cnt; i++) {
+        seg = &adcq_seg[i];
+        if (!adcq_seg_overlaps(seg))
+            continue;
+        if (seg_fn != NULL && adcq_seg_inside(seg) && seg_fn(seg)) {
+            adcq_n_seg_sum++;
+            continue;
+        }
+
+        if (seg->blk == NULL && adcq_idx_load(seg, i + 1 == adcq_seg_cnt) ==
+          -1)
+            continue;
+
+        /* Every block has to be looked at if the clock went back */
+        if (!seg->ih.sorted) {
+            for (b = 0; b < seg->ih.blocks; b++) {
+                if (adcq_blk_overlaps(&seg->blk[b]))
+                    fn(seg, b, adcq_blk_inside(&seg->blk[b]));
+            }
+            continue;
+        }
+        for (b = adcq_blk_find(seg); b < seg->ih.blocks &&
+          seg->blk[b].t0_ns < adcq_to; b++)
+            fn(seg, b, adcq_blk_inside(&seg->blk[b]));
+    }
+}
+
+static void adcq_print_time(FILE *f, uint64_t ns)
+{
+    time_t t = ns / 1000000000ULL;
+    struct tm tm;
+    char buf[32];
+
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(f, "%s.%03u", buf, (unsigned int)((ns / 1000000) % 1000));
+}
+
+/*
+ * info
+ */
+static bool adcq_info_seg(struct adcq_seg *seg)
+{
+    fprintf(stdout, ADCFMT_SEG_NAME ": %u blocks, ", seg->num, seg->ih.blocks);
+    adcq_print_time(stdout, seg->ih.t_first);
+    fprintf(stdout, " to ");
+    adcq_print_time(stdout, seg->ih.t_last);
+    fprintf(stdout, seg->ih.sorted ? "\n" : ", clock stepped back\n");
+
+    return true;
+}
+
+static int adcq_info(void)
+{
+    unsigned int i;
+
+    /* The whole log, whatever range was asked for */
+    for (i = 0; i < adcq_seg_cnt; i++) {
+        if (adcq_seg[i].ih.blocks > 0)
+            adcq_info_seg(&adcq_seg[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * stats
+ */
+static struct adcq_sum adcq_total;
+
+static bool adcq_stats_seg(struct adcq_seg *seg)
+{
+    adcq_sum_merge(&adcq_total, &seg->ih.sum);
+
+    return true;
+}
+
+static void adcq_stats_blk(struct adcq_seg *seg, unsigned int idx,
+  bool inside)
+{
+    static int32_t out[ADCQ_SCANS_MAX][ADCFMT_CHAN_MAX];
+    const struct adcfmt_hdr *hdr = &seg->blk[idx];
+    struct adcq_sum s;
+    uint64_t t;
+    unsigned int c;
+    int i, n;
+
+    adcq_sum_blk(&s, hdr);
+    if (!inside) {
+        n = adcq_blk_decode(seg, idx, out);
+        adcq_sum_init(&s);
+        s.modes_any = s.modes_all = hdr->modes;
+        for (i = 0; i < n; i++) {
+            t = hdr->t0_ns + (i * (uint64_t)hdr->period_ns);
+            if (t < adcq_from || t >= adcq_to)
+                continue;
+            for (c = 0; c < hdr->chans; c++) {
+                if (!(hdr->valid & (1U << c)))
+                    continue;
+                s.n[c]++;
+                s.sum[c] += out[i][c];
+                if (out[i][c] < s.min[c])
+                    s.min[c] = out[i][c];
+                if (out[i][c] > s.max[c])
+                    s.max[c] = out[i][c];
+            }
+        }
+    } else {
+        adcq_n_blk_sum++;
+    }
+
+    adcq_sum_merge(&adcq_total, &s);
+}
+
+static int adcq_stats(void)
+{
+    const char *unit;
+    unsigned int c;
+
+    adcq_sum_init(&adcq_total);
+    adcq_walk(adcq_stats_seg, adcq_stats_blk);
+
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        if (!(adcq_chans & (1U << c)) || adcq_total.n[c] == 0)
+            continue;
+
+        unit = "mV";
+        if (adcq_total.modes_all & (1U << c))
+            unit = "uA";
+        else if (adcq_total.modes_any & (1U << c))
+            unit = "mV/uA mixed";
+
+        printf("adc%u: n %llu min %d max %d mean %.1f %s\n", c,
+          (unsigned long long)adcq_total.n[c], adcq_total.min[c],
+          adcq_total.max[c], (double)adcq_total.sum[c] / adcq_total.n[c],
+          unit);
+    }
+
+    return 0;
+}
+
+/*
+ * cross
+ */
+static int32_t adcq_level;
+static unsigned int adcq_cross_dir = ADCQ_RISE | ADCQ_FALL;
+
+/* Which side of the level each channel was last seen on, -1 for not yet */
+static int adcq_side[ADCFMT_CHAN_MAX] = { -1, -1, -1, -1 };
+
+static void adcq_cross_to(unsigned int c, int side, uint64_t t, int32_t v)
+{
+    if (adcq_side[c] != -1 && adcq_side[c] != side &&
+      (adcq_cross_dir & (side ? ADCQ_RISE : ADCQ_FALL))) {
+        adcq_print_time(stdout, t);
+        printf(" adc%u %s %d\n", c, side ? "rise" : "fall", v);
+    }
+    adcq_side[c] = side;
+}
+
+/* Every channel asked for stays on one side of the level, so only where it
+ * picks up from the last can cross. Returns false if any doesn't.
+ */
+static bool adcq_cross_flat(const struct adcq_sum *s, uint8_t valid,
+  unsigned int chans, uint64_t t)
+{
+    unsigned int c;
+
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        if (adcq_chan_ok(valid, chans, c) && s->n[c] > 0 &&
+          s->min[c] < adcq_level && s->max[c] >= adcq_level)
+            return false;
+    }
+
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        if (adcq_chan_ok(valid, chans, c) && s->n[c] > 0)
+            adcq_cross_to(c, s->min[c] >= adcq_level, t,
+              s->min[c] >= adcq_level ? s->min[c] : s->max[c]);
+    }
+
+    return true;
+}
+
+static bool adcq_cross_seg(struct adcq_seg *seg)
+{
+    return adcq_cross_flat(&seg->ih.sum, 0xff, ADCFMT_CHAN_MAX,
+      seg->ih.t_first);
+}
+
+static void adcq_cross_blk(struct adcq_seg *seg, unsigned int idx,
+  bool inside)
+{
+    static int32_t out[ADCQ_SCANS_MAX][ADCFMT_CHAN_MAX];
+    const struct adcfmt_hdr *hdr = &seg->blk[idx];
+    struct adcq_sum s;
+    uint64_t t;
+    unsigned int c;
+    int i, n;
+
+    adcq_sum_blk(&s, hdr);
+    if (inside && adcq_cross_flat(&s, hdr->valid, hdr->chans, hdr->t0_ns)) {
+        adcq_n_blk_sum++;
+        return;
+    }
+
+    n = adcq_blk_decode(seg, idx, out);
+    for (i = 0; i < n; i++) {
+        t = hdr->t0_ns + (i * (uint64_t)hdr->period_ns);
+        if (t < adcq_from || t >= adcq_to)
+            continue;
+        for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+            if (adcq_chan_ok(hdr->valid, hdr->chans, c))
+                adcq_cross_to(c, out[i][c] >= adcq_level, t, out[i][c]);
+        }
+    }
+}
+
+static int adcq_cross(void)
+{
+    adcq_walk(adcq_cross_seg, adcq_cross_blk);
+
+    return 0;
+}
+
+/*
+ * export
+ */
+static FILE *adcq_out;
+static bool adcq_csv;
+
+/* A row group of the columnar format, one per block, followed by a column
+ * of int32_t for each channel exported, in order.
+ */
+struct adcq_col_group {
+    uint32_t rows;
+    uint32_t period_ns;
+    uint64_t t0_ns;
+    uint8_t valid;
+    uint8_t modes;
+    uint8_t pad[6];
+};
+
+static void adcq_export_blk(struct adcq_seg *seg, unsigned int idx,
+  bool inside)
+{
+    static int32_t out[ADCQ_SCANS_MAX][ADCFMT_CHAN_MAX];
+    static int32_t col[ADCQ_SCANS_MAX];
+    const struct adcfmt_hdr *hdr = &seg->blk[idx];
+    struct adcq_col_group g = { 0 };
+    unsigned int c, first = 0, rows = 0;
+    uint64_t t;
+    int i, n;
+
+    /* Every block is decoded, only the scans in range are written */
+    (void)inside;
+    n = adcq_blk_decode(seg, idx, out);
+    for (i = 0; i < n; i++) {
+        t = hdr->t0_ns + (i * (uint64_t)hdr->period_ns);
+        if (t < adcq_from || t >= adcq_to)
+            continue;
+        if (rows++ == 0)
+            first = i;
+        if (!adcq_csv)
+            continue;
+
+        fprintf(adcq_out, "%llu.%09llu",
+          (unsigned long long)(t / 1000000000ULL),
+          (unsigned long long)(t % 1000000000ULL));
+        for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+            if (!(adcq_chans & (1U << c)))
+                continue;
+            if (adcq_chan_ok(hdr->valid, hdr->chans, c))
+                fprintf(adcq_out, ",%d", out[i][c]);
+            else
+                fputc(',', adcq_out);
+        }
+        fprintf(adcq_out, ",%u\n", hdr->modes);
+    }
+
+    if (adcq_csv || rows == 0)
+        return;
+
+    g.rows = rows;
+    g.period_ns = hdr->period_ns;
+    g.t0_ns = hdr->t0_ns + (first * (uint64_t)hdr->period_ns);
+    g.valid = hdr->valid & adcq_chans;
+    g.modes = hdr->modes;
+    fwrite(&g, sizeof(g), 1, adcq_out);
+    for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+        if (!(adcq_chans & (1U << c)))
+            continue;
+        for (i = 0; i < (int)rows; i++)
+            col[i] = adcq_chan_ok(hdr->valid, hdr->chans, c) ?
+              out[first + i][c] : 0;
+        fwrite(col, sizeof(col[0]), rows, adcq_out);
+    }
+}
+
+static int adcq_export(const char *format, const char *path)
+{
+    uint8_t hdr[16] = ADCQ_COL_MAGIC;
+    unsigned int c;
+
+    if (strcmp(format, "csv") == 0)
+        adcq_csv = true;
+    else if (strcmp(format, "col") != 0)
+        return -1;
+
+    adcq_out = stdout;
+    if (path != NULL) {
+        adcq_out = fopen(path, "w");
+        if (adcq_out == NULL) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    if (adcq_csv) {
+        fprintf(adcq_out, "time");
+        for (c = 0; c < ADCFMT_CHAN_MAX; c++) {
+            if (adcq_chans & (1U << c))
+                fprintf(adcq_out, ",adc%u", c);
+        }
+        fprintf(adcq_out, ",modes\n");
+    } else {
+        /* Magic, then the channels exported */
+        hdr[8] = adcq_chans;
+        fwrite(hdr, sizeof(hdr), 1, adcq_out);
+    }
+
+    adcq_walk(NULL, adcq_export_blk);
+
+    if (fclose(adcq_out) != 0) {
+        perror("export");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Either seconds since the epoch, or local time, both with an optional
+ * fraction, e.g. 1700000000.5 or 2024-03-01T12:00:00.250
+ */
+static bool adcq_parse_time(const char *s, uint64_t *ns)
+{
+    unsigned long long sec, scale = 100000000ULL;
+    uint64_t frac = 0;
+    struct tm tm = { 0 };
+    const char *end;
+    char *p;
+    time_t t;
+
+    end = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end != NULL) {
+        tm.tm_isdst = -1;
+        t = mktime(&tm);
+        if (t == -1)
+            return false;
+        sec = t;
+    } else {
+        errno = 0;
+        sec = strtoull(s, &p, 10);
+        if (p == s || errno != 0)
+            return false;
+        end = p;
+    }
+
+    if (*end == '.') {
+        for (end++; *end >= '0' && *end <= '9'; end++) {
+            frac += (*end - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (*end != '\0')
+        return false;
+
+    *ns = (sec * 1000000000ULL) + frac;
+    return true;
+}
+
+static bool adcq_parse_chans(const char *s)
+{
+    unsigned long c;
+    char *p;
+
+    adcq_chans = 0;
+    do {
+        c = strtoul(s, &p, 10);
+        if (p == s || c >= ADCFMT_CHAN_MAX)
+            return false;
+        adcq_chans |= 1U << c;
+        s = p + 1;
+    } while (*p == ',');
+
+    return *p == '\0';
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d DIR] [-f FROM] [-t TO] [-c CHANS] COMMAND\n"
+      "  -d  Log directory, as given to the demo's -l, by default .\n"
+      "  -f  Start of the range, seconds since the epoch or local time as\n"
+      "      YYYY-MM-DDTHH:MM:SS, either with an optional fraction\n"
+      "  -t  End of the range, not included, the same way\n"
+      "  -c  Channels, e.g. 0,2, by default all. Channels are numbered in\n"
+      "      the order of the demo's ADC meter\n"
+      "Commands:\n"
+      "  info                    Segments and the times they cover\n"
+      "  stats                   Count, min, max and mean of each channel\n"
+      "  cross LEVEL [rise|fall] Times each channel crosses LEVEL\n"
+      "  export csv|col [FILE]   Every sample in the range, to FILE or\n"
+      "                          stdout. col is columnar binary: a 16 byte\n"
+      "                          header of \"" ADCQ_COL_MAGIC "\" and the\n"
+      "                          channel mask, then per block a 24 byte\n"
+      "                          group header of rows, period_ns, t0_ns,\n"
+      "                          valid and mode masks, and a column of\n"
+      "                          int32 per channel, all little endian\n"
+      "Values are in mV, or uA for channels in current mode.\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = ".";
+    const char *cmd;
+    char *p;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "+c:d:f:t:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (!adcq_parse_chans(optarg)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'f':
+            if (!adcq_parse_time(optarg, &adcq_from)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            if (!adcq_parse_time(optarg, &adcq_to)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    cmd = argv[optind++];
+
+    if (adcq_open(dir) == -1) {
+        perror(dir);
+        return 1;
+    }
+
+    if (strcmp(cmd, "info") == 0 && optind == argc) {
+        ret = adcq_info();
+    } else if (strcmp(cmd, "stats") == 0 && optind == argc) {
+        ret = adcq_stats();
+    } else if (strcmp(cmd, "cross") == 0 && optind < argc &&
+      argc - optind <= 2) {
+        errno = 0;
+        adcq_level = strtol(argv[optind], &p, 10);
+        if (p == argv[optind] || *p != '\0' || errno != 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (optind + 1 < argc) {
+            if (strcmp(argv[optind + 1], "rise") == 0) {
+                adcq_cross_dir = ADCQ_RISE;
+            } else if (strcmp(argv[optind + 1], "fall") == 0) {
+                adcq_cross_dir = ADCQ_FALL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        ret = adcq_cross();
+    } else if (strcmp(cmd, "export") == 0 && optind < argc &&
+      argc - optind <= 2) {
+        ret = adcq_export(argv[optind],
+          (optind + 1 < argc) ? argv[optind + 1] : NULL);
+        if (ret == -1) {
+            usage(argv[0]);
+            return 1;
+        }
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(cmd, "info") != 0)
+        fprintf(stderr, "%u segment summaries, %u block summaries, "
+          "%u blocks decoded\n", adcq_n_seg_sum, adcq_n_blk_sum,
+          adcq_n_decoded);
+
+    return ret;
+}
@@ -0,0 +1,62 @@
+#include <math.h>
+#include <stdint.h>
+
+/* Built with NO_SIMD, only the plain C path is used */
+#if !defined(NO_SIMD) && defined(__ARM_NEON)
+#define CAL_NEON
+#include <arm_neon.h>
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define CAL_SSE2
+#include <immintrin.h>
+#endif
+
+#include "cal.h"
+
+int cal_init(struct cal *cal, double scale, double offset, double gain,
+  double bias)
+{
+    double g = scale * gain * (1 << CAL_SHIFT);
+
+    if (!(g >= 0 && g < INT16_MAX + 1.0))
+        return -1;
+
+    cal->gain = lround(g);
+    /* Half an LSB of the output so that the shift rounds to nearest */
+    cal->bias = lround(((offset * scale * gain) + bias) * (1 << CAL_SHIFT)) +
+      (1 << (CAL_SHIFT - 1));
+
+    return 0;
+}
+
+void cal_apply(const struct cal *cal, int32_t *out, const int32_t *raw,
+  unsigned int n)
+{
+    unsigned int i = 0;
+
+#if defined(CAL_NEON)
+    int32x4_t gain = vdupq_n_s32(cal->gain);
+    int32x4_t bias = vdupq_n_s32(cal->bias);
+
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t v = vmlaq_s32(bias, vld1q_s32(raw + i), gain);
+        vst1q_s32(out + i, vshrq_n_s32(v, CAL_SHIFT));
+    }
+#elif defined(CAL_SSE2)
+    /* No 32 bit multiply before SSE4.1, but with the samples and gain both
+     * fitting in 16 bits, a multiply-add of 16 bit pairs gives the whole
+     * product in each 32 bit lane: the gain's upper half is 0, so only the
+     * sample's low half times the gain is left.
+     */
+    __m128i gain = _mm_set1_epi32(cal->gain);
+    __m128i bias = _mm_set1_epi32(cal->bias);
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(raw + i));
+        v = _mm_add_epi32(_mm_madd_epi16(v, gain), bias);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_srai_epi32(v, CAL_SHIFT));
+    }
+#endif
+
+    for (; i < n; i++)
+        out[i] = ((raw[i] * cal->gain) + cal->bias) >> CAL_SHIFT;
+}
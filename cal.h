@@ -0,0 +1,36 @@
+#ifndef __CAL_H__
+#define __CAL_H__
+#include <stdint.h>
+
+/* Raw ADC samples are converted to engineering units in fixed point:
+ *
+ *   out = (raw * gain + bias) >> CAL_SHIFT
+ *
+ * so that whole buffers can be run through a SIMD kernel. Samples must fit
+ * in 16 bits, signed, and the gain in 15, i.e. less than 8 units per LSB.
+ */
+#define CAL_SHIFT 12
+
+struct cal {
+    int32_t gain;
+    int32_t bias;
+};
+
+/* Work out the fixed point form of
+ *
+ *   out = (raw + offset) * scale * gain + bias
+ *
+ * where `scale` and `offset` are the channel's IIO attributes, taking it to
+ * mV at the ADC, and `gain` and `bias` its calibration from there on to
+ * whatever the input is measured in. Returns -1 if the gain is out of range.
+ */
+int cal_init(struct cal *cal, double scale, double offset, double gain,
+  double bias);
+
+/* Convert `n` samples, `out` may be `raw`. Uses NEON or SSE2 where the
+ * compiler targets them.
+ */
+void cal_apply(const struct cal *cal, int32_t *out, const int32_t *raw,
+  unsigned int n);
+
+#endif // __CAL_H__
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "cap.h"
+#include "loop.h"
+#include "ring.h"
+#include "stats.h"
+
+/* Around a second of every input toggling at a few kHz, should the UI stall */
+#define CAP_RING_SLOTS 4096
+
+/* Most lines captured, and edges read from one line at a time */
+#define CAP_LINE_MAX 8
+#define CAP_BATCH 64
+
+struct cap_line {
+    GPIOL1 *gpio;
+    unsigned int chan;
+};
+
+static struct cap_line cap_line[CAP_LINE_MAX];
+static unsigned int cap_line_cnt;
+
+static cap_cb_t cap_cb;
+
+static struct ring cap_ring;
+
+/* The I/O thread waits on the first, the main loop watches the second */
+static int cap_epoll_fd = -1;
+static int cap_event_fd = -1;
+
+void cap_set_cb(cap_cb_t cb)
+{
+    cap_cb = cb;
+}
+
+static uint64_t cap_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void cap_push(const struct cap_edge *edge, unsigned int *lost,
+  bool *wake)
+{
+    if (ring_push(&cap_ring, edge))
+        *wake = true;
+    else
+        (*lost)++;
+}
+
+int cap_add(GPIOL1 *gpio, unsigned int chan)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    struct cap_edge edge = { .chan = chan };
+    int fd;
+
+    fd = gpio_event_fd(gpio);
+    if (fd == -1 || cap_epoll_fd == -1 || cap_line_cnt == CAP_LINE_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ev.data.u32 = cap_line_cnt;
+    if (epoll_ctl(cap_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+    cap_line[cap_line_cnt].gpio = gpio;
+    cap_line[cap_line_cnt++].chan = chan;
+
+    /* Where the line starts from, the edges take it from there */
+    edge.level = gpio_ival_get(gpio) > 0;
+    edge.ts_ns = cap_now_ns();
+    if (ring_push(&cap_ring, &edge))
+        loop_efd_signal(cap_event_fd);
+
+    return 0;
+}
+
+int cap_fd(void)
+{
+    return cap_epoll_fd;
+}
+
+void cap_run(void)
+{
+    struct epoll_event events[CAP_LINE_MAX];
+    struct gpio_event ev[CAP_BATCH];
+    struct cap_edge edge;
+    struct cap_line *line;
+    unsigned int lost = 0;
+    bool wake = false;
+    int i, j, n, cnt;
+
+    n = epoll_wait(cap_epoll_fd, events, CAP_LINE_MAX, 0);
+    for (i = 0; i < n; i++) {
+        line = &cap_line[events[i].data.u32];
+        edge.chan = line->chan;
+
+        do {
+            cnt = gpio_event_read(line->gpio, ev, CAP_BATCH);
+            for (j = 0; j < cnt; j++) {
+                edge.ts_ns = ev[j].ts_ns;
+                edge.level = ev[j].level;
+                cap_push(&edge, &lost, &wake);
+            }
+        } while (cnt == CAP_BATCH);
+    }
+
+    /* The UI has fallen a long way behind, the newest edges are dropped */
+    if (lost > 0)
+        stats_record(STAT_CAP_LOST, lost);
+
+    /* One wakeup for the whole batch */
+    if (wake)
+        loop_efd_signal(cap_event_fd);
+}
+
+/* Hand the edges over, once per main loop wakeup */
+static void cap_drain(int fd, uint32_t events, void *user_data)
+{
+    struct cap_edge edge;
+    uint64_t n = 0;
+
+    loop_efd_drain(fd);
+
+    while (ring_pop(&cap_ring, &edge)) {
+        if (cap_cb != NULL)
+            cap_cb(&edge);
+        n++;
+    }
+    stats_record(STAT_CAP_EDGES, n);
+}
+
+int cap_start(void)
+{
+    if (ring_init(&cap_ring, CAP_RING_SLOTS, sizeof(struct cap_edge)) == -1)
+        return -1;
+
+    cap_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (cap_epoll_fd == -1)
+        goto out_ring;
+
+    cap_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cap_event_fd == -1)
+        goto out_epoll;
+
+    if (loop_add_fd(cap_event_fd, EPOLLIN, cap_drain, NULL) == -1)
+        goto out_event;
+
+    return 0;
+
+out_event:
+    close(cap_event_fd);
+    cap_event_fd = -1;
+out_epoll:
+    close(cap_epoll_fd);
+    cap_epoll_fd = -1;
+out_ring:
+    ring_free(&cap_ring);
+    return -1;
+}
@@ -0,0 +1,42 @@
+#ifndef __CAP_H__
+#define __CAP_H__
+#include <stdint.h>
+
+#include "gpiolib1.h"
+
+/* Edge capture of inputs claimed with gpio_alloc_events(). The I/O thread
+ * reads every edge the kernel queues, as it happens, and hands them to the
+ * UI thread through a fixed size lock-free ring, along with the kernel's
+ * timestamp. The UI is woken once for each batch read rather than for each
+ * edge, so a fast input doesn't cost a pass of the main loop per edge.
+ */
+
+struct cap_edge {
+    uint64_t ts_ns;         /* CLOCK_MONOTONIC, see gpio_event_read() */
+    unsigned int chan;
+    int level;
+};
+
+/* Called on the UI thread for each edge, oldest first. The first one seen
+ * for a channel is its level when it was added, not an edge.
+ */
+typedef void (*cap_cb_t)(const struct cap_edge *edge);
+
+void cap_set_cb(cap_cb_t cb);
+
+/* Set up the ring and register with the main loop, before io_start().
+ * Returns -1 on error.
+ */
+int cap_start(void);
+
+/* For the I/O thread only. cap_add() starts capturing a line as `chan`,
+ * cap_fd() is the fd to wait on, and cap_run() reads whatever edges are
+ * pending once it is readable.
+ */
+int cap_add(GPIOL1 *gpio, unsigned int chan);
+
+int cap_fd(void);
+
+void cap_run(void);
+
+#endif // __CAP_H__
@@ -0,0 +1,390 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Built with NO_SIMD, only the plain C path is used */
+#if !defined(NO_SIMD) && defined(__ARM_NEON)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define CONVERT_SSE2
+#include <immintrin.h>
+#endif
+
+#include "convert.h"
+
+/* Each converter runs as many whole vectors as it can and finishes the tail,
+ * or everything when there is no SIMD for it, with the per pixel helpers
+ * below. 5 and 6 bit channels are widened by repeating their top bits, so
+ * white stays white.
+ */
+
+static inline uint16_t px_8888_to_565(uint32_t p)
+{
+    return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+static inline uint32_t px_565_to_8888(uint16_t p)
+{
+    uint32_t r = (p >> 8) & 0xf8;
+    uint32_t g = (p >> 3) & 0xfc;
+    uint32_t b = (p << 3) & 0xf8;
+
+    r |= r >> 5;
+    g |= g >> 6;
+    b |= b >> 5;
+
+    return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static inline uint32_t px_888_load(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static inline void px_888_store(uint8_t *p, uint32_t px)
+{
+    p[0] = px & 0xff;
+    p[1] = (px >> 8) & 0xff;
+    p[2] = (px >> 16) & 0xff;
+}
+
+#if defined(CONVERT_SSE2)
+/* 8 RGB565 pixels to two vectors of 4 ARGB8888 */
+static inline void sse_565_to_8888(__m128i v, __m128i *lo, __m128i *hi)
+{
+    __m128i r, g, b;
+
+    r = _mm_and_si128(_mm_srli_epi16(v, 8), _mm_set1_epi16(0xf8));
+    g = _mm_and_si128(_mm_srli_epi16(v, 3), _mm_set1_epi16(0xfc));
+    b = _mm_and_si128(_mm_slli_epi16(v, 3), _mm_set1_epi16(0xf8));
+    r = _mm_or_si128(r, _mm_srli_epi16(r, 5));
+    g = _mm_or_si128(g, _mm_srli_epi16(g, 6));
+    b = _mm_or_si128(b, _mm_srli_epi16(b, 5));
+
+    g = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    r = _mm_or_si128(r, _mm_set1_epi16((short)0xff00));
+    *lo = _mm_unpacklo_epi16(g, r);
+    *hi = _mm_unpackhi_epi16(g, r);
+}
+
+/* Two vectors of 4 ARGB8888 pixels to 8 RGB565. There is no unsigned 32 to
+ * 16 bit pack before SSE4.1, so the values are biased into signed range for
+ * the saturating pack and back again after.
+ */
+static inline __m128i sse_8888_to_565(__m128i lo, __m128i hi)
+{
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    __m128i v[2] = { lo, hi };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        v[i] = _mm_or_si128(_mm_or_si128(
+          _mm_and_si128(_mm_srli_epi32(v[i], 8), _mm_set1_epi32(0xf800)),
+          _mm_and_si128(_mm_srli_epi32(v[i], 5), _mm_set1_epi32(0x07e0))),
+          _mm_and_si128(_mm_srli_epi32(v[i], 3), _mm_set1_epi32(0x001f)));
+        v[i] = _mm_sub_epi32(v[i], bias);
+    }
+
+    return _mm_add_epi16(_mm_packs_epi32(v[0], v[1]),
+      _mm_set1_epi16((short)0x8000));
+}
+
+#if defined(__SSSE3__)
+/* 4 ARGB8888 pixels to 12 bytes of RGB888 in the low part of the vector */
+static inline __m128i sse_8888_to_888(__m128i v)
+{
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+      12, 13, 14, -1, -1, -1, -1));
+}
+
+/* The low 12 bytes of RGB888 to 4 ARGB8888 pixels */
+static inline __m128i sse_888_to_8888(__m128i v)
+{
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+      -1, 9, 10, 11, -1));
+    return _mm_or_si128(v, _mm_set1_epi32(0xff000000));
+}
+#endif
+#endif
+
+static void conv_copy16(void *dst, const void *src, int n)
+{
+    memcpy(dst, src, n * 2);
+}
+
+static void conv_copy24(void *dst, const void *src, int n)
+{
+    memcpy(dst, src, n * 3);
+}
+
+static void conv_copy32(void *dst, const void *src, int n)
+{
+    memcpy(dst, src, n * 4);
+}
+
+/* X may be anything, make the pixels opaque */
+static void conv_xrgb8888_to_argb8888(void *dst, const void *src, int n)
+{
+    uint32_t *d = dst;
+    const uint32_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    for (; i + 4 <= n; i += 4)
+        vst1q_u32(d + i, vorrq_u32(vld1q_u32(s + i), vdupq_n_u32(0xff000000)));
+#elif defined(CONVERT_SSE2)
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(
+          _mm_loadu_si128((const __m128i *)(s + i)),
+          _mm_set1_epi32(0xff000000)));
+#endif
+    for (; i < n; i++)
+        d[i] = s[i] | 0xff000000;
+}
+
+static void conv_argb8888_to_rgb565(void *dst, const void *src, int n)
+{
+    uint16_t *d = dst;
+    const uint32_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint8x8x4_t p;
+    uint16x8_t v;
+
+    for (; i + 8 <= n; i += 8) {
+        p = vld4_u8((const uint8_t *)(s + i));
+        v = vshll_n_u8(p.val[2], 8);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[1], 8), 5);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[0], 8), 11);
+        vst1q_u16(d + i, v);
+    }
+#elif defined(CONVERT_SSE2)
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(d + i), sse_8888_to_565(
+          _mm_loadu_si128((const __m128i *)(s + i)),
+          _mm_loadu_si128((const __m128i *)(s + i + 4))));
+#endif
+    for (; i < n; i++)
+        d[i] = px_8888_to_565(s[i]);
+}
+
+static void conv_argb8888_to_rgb888(void *dst, const void *src, int n)
+{
+    uint8_t *d = dst;
+    const uint32_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint8x8x4_t p;
+    uint8x8x3_t q;
+
+    for (; i + 8 <= n; i += 8) {
+        p = vld4_u8((const uint8_t *)(s + i));
+        q.val[0] = p.val[0];
+        q.val[1] = p.val[1];
+        q.val[2] = p.val[2];
+        vst3_u8(d + (i * 3), q);
+    }
+#elif defined(CONVERT_SSE2) && defined(__SSSE3__)
+    /* Each store writes 16 bytes of which 12 are pixels, the rest is
+     * overwritten by the next store. Stop while that is still in bounds.
+     */
+    for (; i + 6 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(d + (i * 3)),
+          sse_8888_to_888(_mm_loadu_si128((const __m128i *)(s + i))));
+#endif
+    for (; i < n; i++)
+        px_888_store(d + (i * 3), s[i]);
+}
+
+static void conv_rgb565_to_argb8888(void *dst, const void *src, int n)
+{
+    uint32_t *d = dst;
+    const uint16_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint16x8_t v;
+    uint8x8x4_t p;
+
+    p.val[3] = vdup_n_u8(0xff);
+    for (; i + 8 <= n; i += 8) {
+        v = vld1q_u16(s + i);
+        p.val[2] = vshrn_n_u16(v, 8);
+        p.val[1] = vshrn_n_u16(v, 3);
+        p.val[0] = vmovn_u16(vshlq_n_u16(v, 3));
+        p.val[2] = vsri_n_u8(p.val[2], p.val[2], 5);
+        p.val[1] = vsri_n_u8(p.val[1], p.val[1], 6);
+        p.val[0] = vsri_n_u8(p.val[0], p.val[0], 5);
+        vst4_u8((uint8_t *)(d + i), p);
+    }
+#elif defined(CONVERT_SSE2)
+    __m128i lo, hi;
+
+    for (; i + 8 <= n; i += 8) {
+        sse_565_to_8888(_mm_loadu_si128((const __m128i *)(s + i)), &lo, &hi);
+        _mm_storeu_si128((__m128i *)(d + i), lo);
+        _mm_storeu_si128((__m128i *)(d + i + 4), hi);
+    }
+#endif
+    for (; i < n; i++)
+        d[i] = px_565_to_8888(s[i]);
+}
+
+static void conv_rgb565_to_rgb888(void *dst, const void *src, int n)
+{
+    uint8_t *d = dst;
+    const uint16_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint16x8_t v;
+    uint8x8x3_t p;
+
+    for (; i + 8 <= n; i += 8) {
+        v = vld1q_u16(s + i);
+        p.val[2] = vshrn_n_u16(v, 8);
+        p.val[1] = vshrn_n_u16(v, 3);
+        p.val[0] = vmovn_u16(vshlq_n_u16(v, 3));
+        p.val[2] = vsri_n_u8(p.val[2], p.val[2], 5);
+        p.val[1] = vsri_n_u8(p.val[1], p.val[1], 6);
+        p.val[0] = vsri_n_u8(p.val[0], p.val[0], 5);
+        vst3_u8(d + (i * 3), p);
+    }
+#elif defined(CONVERT_SSE2) && defined(__SSSE3__)
+    __m128i lo, hi;
+
+    /* See conv_argb8888_to_rgb888() for the bound */
+    for (; i + 10 <= n; i += 8) {
+        sse_565_to_8888(_mm_loadu_si128((const __m128i *)(s + i)), &lo, &hi);
+        _mm_storeu_si128((__m128i *)(d + (i * 3)), sse_8888_to_888(lo));
+        _mm_storeu_si128((__m128i *)(d + (i * 3) + 12), sse_8888_to_888(hi));
+    }
+#endif
+    for (; i < n; i++)
+        px_888_store(d + (i * 3), px_565_to_8888(s[i]));
+}
+
+static void conv_rgb888_to_argb8888(void *dst, const void *src, int n)
+{
+    uint32_t *d = dst;
+    const uint8_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint8x8x3_t p;
+    uint8x8x4_t q;
+
+    q.val[3] = vdup_n_u8(0xff);
+    for (; i + 8 <= n; i += 8) {
+        p = vld3_u8(s + (i * 3));
+        q.val[0] = p.val[0];
+        q.val[1] = p.val[1];
+        q.val[2] = p.val[2];
+        vst4_u8((uint8_t *)(d + i), q);
+    }
+#elif defined(CONVERT_SSE2) && defined(__SSSE3__)
+    /* Loads read 4 bytes past the 12 used, stop while that is in bounds */
+    for (; i + 6 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(d + i), sse_888_to_8888(
+          _mm_loadu_si128((const __m128i *)(s + (i * 3)))));
+#endif
+    for (; i < n; i++)
+        d[i] = 0xff000000 | px_888_load(s + (i * 3));
+}
+
+static void conv_rgb888_to_rgb565(void *dst, const void *src, int n)
+{
+    uint16_t *d = dst;
+    const uint8_t *s = src;
+    int i = 0;
+
+#if defined(CONVERT_NEON)
+    uint8x8x3_t p;
+    uint16x8_t v;
+
+    for (; i + 8 <= n; i += 8) {
+        p = vld3_u8(s + (i * 3));
+        v = vshll_n_u8(p.val[2], 8);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[1], 8), 5);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[0], 8), 11);
+        vst1q_u16(d + i, v);
+    }
+#elif defined(CONVERT_SSE2) && defined(__SSSE3__)
+    for (; i + 10 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(d + i), sse_8888_to_565(
+          sse_888_to_8888(_mm_loadu_si128((const __m128i *)(s + (i * 3)))),
+          sse_888_to_8888(_mm_loadu_si128(
+          (const __m128i *)(s + (i * 3) + 12)))));
+#endif
+    for (; i < n; i++)
+        d[i] = px_8888_to_565(px_888_load(s + (i * 3)));
+}
+
+struct convert_desc {
+    enum pix_fmt from;
+    enum pix_fmt to;
+    convert_fn_t fn;
+};
+
+/* XRGB8888 and ARGB8888 only differ in whether the top byte means anything,
+ * going to XRGB8888 it is simply left as it is.
+ */
+static const struct convert_desc convert_desc[] = {
+    { PIX_FMT_RGB565, PIX_FMT_RGB565, conv_copy16 },
+    { PIX_FMT_RGB888, PIX_FMT_RGB888, conv_copy24 },
+    { PIX_FMT_XRGB8888, PIX_FMT_XRGB8888, conv_copy32 },
+    { PIX_FMT_ARGB8888, PIX_FMT_ARGB8888, conv_copy32 },
+    { PIX_FMT_ARGB8888, PIX_FMT_XRGB8888, conv_copy32 },
+    { PIX_FMT_XRGB8888, PIX_FMT_ARGB8888, conv_xrgb8888_to_argb8888 },
+
+    { PIX_FMT_ARGB8888, PIX_FMT_RGB565, conv_argb8888_to_rgb565 },
+    { PIX_FMT_XRGB8888, PIX_FMT_RGB565, conv_argb8888_to_rgb565 },
+    { PIX_FMT_ARGB8888, PIX_FMT_RGB888, conv_argb8888_to_rgb888 },
+    { PIX_FMT_XRGB8888, PIX_FMT_RGB888, conv_argb8888_to_rgb888 },
+
+    { PIX_FMT_RGB565, PIX_FMT_ARGB8888, conv_rgb565_to_argb8888 },
+    { PIX_FMT_RGB565, PIX_FMT_XRGB8888, conv_rgb565_to_argb8888 },
+    { PIX_FMT_RGB565, PIX_FMT_RGB888, conv_rgb565_to_rgb888 },
+    { PIX_FMT_RGB888, PIX_FMT_ARGB8888, conv_rgb888_to_argb8888 },
+    { PIX_FMT_RGB888, PIX_FMT_XRGB8888, conv_rgb888_to_argb8888 },
+    { PIX_FMT_RGB888, PIX_FMT_RGB565, conv_rgb888_to_rgb565 },
+
+    { PIX_FMT_NONE, PIX_FMT_NONE, NULL },
+};
+
+convert_fn_t convert_get(enum pix_fmt from, enum pix_fmt to)
+{
+    int i;
+
+    for (i = 0; convert_desc[i].fn != NULL; i++) {
+        if (convert_desc[i].from == from && convert_desc[i].to == to)
+            return convert_desc[i].fn;
+    }
+
+    return NULL;
+}
+
+bool convert_is_copy(enum pix_fmt from, enum pix_fmt to)
+{
+    convert_fn_t fn = convert_get(from, to);
+
+    return fn == conv_copy16 || fn == conv_copy24 || fn == conv_copy32;
+}
+
+unsigned int pix_fmt_size(enum pix_fmt fmt)
+{
+    switch (fmt) {
+    case PIX_FMT_RGB565:
+        return 2;
+    case PIX_FMT_RGB888:
+        return 3;
+    case PIX_FMT_XRGB8888:
+    case PIX_FMT_ARGB8888:
+        return 4;
+    default:
+        return 0;
+    }
+}
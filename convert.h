@@ -0,0 +1,36 @@
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+#include <stdbool.h>
+
+/* Pixel formats, named the way DRM names them, i.e. by the bits of a little
+ * endian word from most to least significant. RGB888 is three bytes, blue
+ * first in memory.
+ */
+enum pix_fmt {
+    PIX_FMT_NONE,
+    PIX_FMT_RGB565,
+    PIX_FMT_RGB888,
+    PIX_FMT_XRGB8888,
+    PIX_FMT_ARGB8888,
+};
+
+/* Convert `n` pixels from one format to another. `dst` and `src` need no
+ * particular alignment and must not overlap.
+ */
+typedef void (*convert_fn_t)(void *dst, const void *src, int n);
+
+/* Pick the converter for a pair of formats, meant to be done once up front
+ * rather than per pixel or per row. Uses NEON or SSE2/SSSE3 where the
+ * compiler targets them. Returns NULL if the pair isn't handled.
+ */
+convert_fn_t convert_get(enum pix_fmt from, enum pix_fmt to);
+
+/* Whether going from one format to the other leaves the pixels as they are,
+ * e.g. ARGB8888 to XRGB8888, so they can be copied or moved around as is.
+ */
+bool convert_is_copy(enum pix_fmt from, enum pix_fmt to);
+
+/* Bytes per pixel, 0 for PIX_FMT_NONE */
+unsigned int pix_fmt_size(enum pix_fmt fmt);
+
+#endif // __CONVERT_H__
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "convert.h"
+
+/* Times every pair of formats convert_get() handles, a full screen of pixels
+ * at a time. Build with -DSIMD=OFF to time the plain C converters instead.
+ */
+#define BENCH_MS 200
+#define BENCH_PIXELS (320 * 240)
+
+static const char *const bench_fmt_name[] = {
+    [PIX_FMT_RGB565] = "RGB565",
+    [PIX_FMT_RGB888] = "RGB888",
+    [PIX_FMT_XRGB8888] = "XRGB8888",
+    [PIX_FMT_ARGB8888] = "ARGB8888",
+};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int main(void)
+{
+    static uint8_t src[BENCH_PIXELS * 4], dst[BENCH_PIXELS * 4];
+    enum pix_fmt from, to;
+    uint64_t start, end, n;
+    convert_fn_t fn;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(src); i++)
+        src[i] = rand();
+
+    printf("%-8s    %-8s %8s %8s\n", "from", "to", "us", "Mpx/s");
+
+    for (from = PIX_FMT_RGB565; from <= PIX_FMT_ARGB8888; from++) {
+        for (to = PIX_FMT_RGB565; to <= PIX_FMT_ARGB8888; to++) {
+            fn = convert_get(from, to);
+            if (fn == NULL)
+                continue;
+
+            n = 0;
+            start = bench_now_ns();
+            do {
+                fn(dst, src, BENCH_PIXELS);
+                n++;
+                end = bench_now_ns();
+            } while (end - start < BENCH_MS * 1000000ULL);
+
+            printf("%-8s -> %-8s %8.1f %8.1f\n", bench_fmt_name[from],
+              bench_fmt_name[to], (end - start) / (n * 1000.0),
+              (n * BENCH_PIXELS * 1000.0) / (end - start));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+
+/* 0 is never a tile's hash, it marks tiles that weren't sent yet */
+static uint64_t *diff_hash;
+static int diff_cols;
+static int diff_rows;
+
+/* Each step is a bijection of the state for a given word, so inputs of the
+ * same length that differ in only one word can never collide.
+ */
+static inline uint64_t diff_mix(uint64_t h, uint64_t v)
+{
+    h ^= v;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+}
+
+/* Hash what `tile` covers of a tile. Where it sits in the tile and its size
+ * go into the seed, so the same pixels drawn over a different part of the
+ * tile don't compare equal.
+ */
+static uint64_t diff_hash_tile(const lv_area_t *tile, const lv_color_t *px,
+  lv_coord_t stride)
+{
+    size_t len = lv_area_get_width(tile) * sizeof(lv_color_t);
+    lv_coord_t h = lv_area_get_height(tile);
+    const uint8_t *p;
+    uint64_t hash, v;
+    size_t i;
+    int y;
+
+    hash = diff_mix(0, ((tile->x1 % DIFF_TILE) << 24) |
+      ((tile->y1 % DIFF_TILE) << 16) | (lv_area_get_width(tile) << 8) | h);
+
+    for (y = 0; y < h; y++, px += stride) {
+        p = (const uint8_t *)px;
+        for (i = 0; i + sizeof(v) <= len; i += sizeof(v)) {
+            memcpy(&v, p + i, sizeof(v));
+            hash = diff_mix(hash, v);
+        }
+        if (i < len) {
+            v = 0;
+            memcpy(&v, p + i, len - i);
+            hash = diff_mix(hash, v);
+        }
+    }
+
+    return hash | 1;
+}
+
+int diff_init(lv_coord_t hor_res, lv_coord_t ver_res)
+{
+    diff_cols = (hor_res + DIFF_TILE - 1) / DIFF_TILE;
+    diff_rows = (ver_res + DIFF_TILE - 1) / DIFF_TILE;
+
+    free(diff_hash);
+    diff_hash = calloc(diff_cols * diff_rows, sizeof(*diff_hash));
+    if (diff_hash == NULL)
+        return -1;
+
+    return 0;
+}
+
+void diff_round(lv_area_t *area)
+{
+    area->x1 -= area->x1 % DIFF_TILE;
+    area->y1 -= area->y1 % DIFF_TILE;
+    area->x2 += DIFF_TILE - 1 - (area->x2 % DIFF_TILE);
+    area->y2 += DIFF_TILE - 1 - (area->y2 % DIFF_TILE);
+}
+
+bool diff_area(const lv_area_t *area, const lv_color_t *px, lv_coord_t stride,
+  lv_area_t *changed)
+{
+    lv_area_t tile;
+    uint64_t hash, *slot;
+    bool any = false;
+    int tx, ty;
+
+    /* Nothing known about what's outside the display, call it all changed */
+    if (area->x1 < 0 || area->y1 < 0 ||
+      area->x2 >= diff_cols * DIFF_TILE || area->y2 >= diff_rows * DIFF_TILE) {
+        *changed = *area;
+        return true;
+    }
+
+    for (ty = area->y1 / DIFF_TILE; ty <= area->y2 / DIFF_TILE; ty++) {
+        tile.y1 = LV_MAX(area->y1, ty * DIFF_TILE);
+        tile.y2 = LV_MIN(area->y2, (ty * DIFF_TILE) + DIFF_TILE - 1);
+
+        for (tx = area->x1 / DIFF_TILE; tx <= area->x2 / DIFF_TILE; tx++) {
+            tile.x1 = LV_MAX(area->x1, tx * DIFF_TILE);
+            tile.x2 = LV_MIN(area->x2, (tx * DIFF_TILE) + DIFF_TILE - 1);
+
+            hash = diff_hash_tile(&tile, px +
+              ((tile.y1 - area->y1) * stride) + (tile.x1 - area->x1), stride);
+            slot = &diff_hash[(ty * diff_cols) + tx];
+            if (*slot == hash)
+                continue;
+            *slot = hash;
+
+            if (any)
+                _lv_area_join(changed, changed, &tile);
+            else
+                *changed = tile;
+            any = true;
+        }
+    }
+
+    return any;
+}
@@ -0,0 +1,37 @@
+#ifndef __DIFF_H__
+#define __DIFF_H__
+#include <stdbool.h>
+
+#include "lvgl/lvgl.h"
+
+/* Frame differencing for the flush worker. A hash is kept for every tile of
+ * the last frame sent to the display, so that an area LVGL redrew can be
+ * trimmed down to the tiles whose pixels actually changed before it is
+ * written out and sent on to the panel.
+ *
+ * Coordinates are LVGL's, i.e. before any software rotation.
+ */
+
+/* Pixels per side of a tile */
+#define DIFF_TILE 8
+
+/* Size the hashes for a `hor_res` x `ver_res` display, every tile starts out
+ * as changed. Returns -1 if out of memory.
+ */
+int diff_init(lv_coord_t hor_res, lv_coord_t ver_res);
+
+/* Grow `area` out to whole tiles, meant for the display driver's rounder_cb.
+ * Areas that don't cover whole tiles still work, but a tile is then only
+ * found to be unchanged if the same part of it is redrawn the same way.
+ */
+void diff_round(lv_area_t *area);
+
+/* Hash the tiles `area` covers and update them. `px` is the area's top left
+ * pixel and `stride` is in pixels. `changed` is set to the bounding box of
+ * the tiles that differ from the last frame, clipped to `area`. Returns false
+ * if none do, `changed` is left alone then.
+ */
+bool diff_area(const lv_area_t *area, const lv_color_t *px, lv_coord_t stride,
+  lv_area_t *changed);
+
+#endif // __DIFF_H__
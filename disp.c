@@ -0,0 +1,541 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lvgl/lvgl.h"
+#include "diff.h"
+#include "disp.h"
+#include "loop.h"
+#include "rotate.h"
+#include "stats.h"
+
+/* LVGL's own pixel format */
+#if LV_COLOR_DEPTH == 16
+#define DISP_LV_FORMAT PIX_FMT_RGB565
+#else
+#define DISP_LV_FORMAT PIX_FMT_ARGB8888
+#endif
+
+/* Physical panel resolution, the UI is normally landscape on top of it */
+#define DISP_HOR_RES 240
+#define DISP_VER_RES 320
+
+/* Two draw buffers, together the same size the single buffer used to be.
+ * LVGL renders into one while the flush worker writes out the other. Not
+ * allocated at all when rendering in direct mode.
+ */
+#define DISP_BUF_SIZE (64 * 1024)
+
+/* LVGL never has more than one flush outstanding, a single slot is enough */
+struct disp_job {
+    lv_disp_drv_t *drv;
+    lv_area_t area;
+    const lv_color_t *color_p;
+    bool last;
+    /* Direct mode, what LVGL rendered in place this frame */
+    lv_area_t damage[DISP_DAMAGE_MAX];
+    int damage_cnt;
+};
+
+/* In order of preference when no backend is asked for */
+static const struct disp_backend *disp_backends[] = {
+#ifdef HAVE_DRM
+    &disp_drm_backend,
+#endif
+    &disp_fbdev_backend,
+    NULL,
+};
+
+static const struct disp_backend *backend;
+static bool hw_rotated;
+static bool direct;
+
+/* Frames are started once the previous one is on screen, see
+ * disp_paced_refresh()
+ */
+static bool paced;
+
+/* From LVGL's format to the surface's, picked once the backend is open */
+static convert_fn_t convert;
+
+/* Only touched by the flush worker */
+static lv_color_t *row_buf;
+static lv_area_t damage[DISP_DAMAGE_MAX];
+static int damage_cnt;
+static uint64_t frame_bytes;
+static uint64_t frame_flush_us;
+
+/* Only touched by the UI thread, for STAT_RENDER_US */
+static uint64_t refr_wait_us;
+static bool refr_rendered;
+
+/* Only touched by the UI thread, see disp_frame_max_take() */
+static uint32_t frame_max_ms;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct disp_job job;
+static bool job_pending;
+
+/* Set while a frame is handed to a paced backend and not yet on screen */
+static atomic_bool frame_pending;
+
+/* Write `n` pixels to the surface starting at physical (x, y), converting to
+ * the surface's format if it differs from LVGL's.
+ */
+static void disp_put_row(struct disp_surface *s, int x, int y,
+  const lv_color_t *px, int n)
+{
+    convert(s->mem + (y * s->stride) + (x * (s->bpp / 8)), px, n);
+}
+
+/* Copy a rendered area out to the surface. The area is in LVGL's (rotated)
+ * coordinates, `src` is its top left pixel and `stride` is in pixels. `phys`
+ * is set to the area that was written in physical coordinates.
+ */
+static void disp_write_area(const lv_disp_drv_t *drv, struct disp_surface *s,
+  const lv_area_t *area, const lv_color_t *src, lv_coord_t stride,
+  lv_area_t *phys)
+{
+    lv_coord_t w = lv_area_get_width(area);
+    lv_coord_t h = lv_area_get_height(area);
+    const lv_color_t *p;
+    int x, y, i;
+
+    if (drv->rotated == LV_DISP_ROT_270) {
+        /* Logical (x, y) lands on physical (hor_res - 1 - y, x). Each logical
+         * column becomes one physical row, walked bottom to top. When the
+         * depth has to be converted too, the column is gathered into row_buf
+         * so the surface is still written sequentially.
+         */
+        phys->x1 = drv->hor_res - 1 - area->y2;
+        phys->x2 = drv->hor_res - 1 - area->y1;
+        phys->y1 = area->x1;
+        phys->y2 = LV_MIN(area->x2, (lv_coord_t)s->height - 1);
+
+        /* Nothing to convert, rotate straight into the surface a tile at a
+         * time
+         */
+        if (convert_is_copy(DISP_LV_FORMAT, s->format) &&
+          rotate_copy(s->mem + (phys->y1 * s->stride) +
+          (phys->x1 * (s->bpp / 8)), s->stride, src, stride * sizeof(lv_color_t),
+          lv_area_get_height(phys), h, s->bpp, LV_DISP_ROT_270) == 0)
+            return;
+
+        for (x = phys->y1; x <= phys->y2; x++) {
+            p = src + ((h - 1) * stride) + (x - area->x1);
+            for (i = 0; i < h; i++, p -= stride)
+                row_buf[i] = *p;
+
+            disp_put_row(s, phys->x1, x, row_buf, h);
+        }
+    } else {
+        *phys = *area;
+        phys->y2 = LV_MIN(area->y2, (lv_coord_t)s->height - 1);
+
+        for (y = phys->y1; y <= phys->y2; y++)
+            disp_put_row(s, area->x1, y, src + ((y - area->y1) * stride), w);
+    }
+}
+
+static void disp_damage_add(const lv_area_t *area)
+{
+    int i;
+
+    if (damage_cnt < DISP_DAMAGE_MAX) {
+        damage[damage_cnt++] = *area;
+        return;
+    }
+
+    for (i = 1; i < damage_cnt; i++) {
+        damage[0].x1 = LV_MIN(damage[0].x1, damage[i].x1);
+        damage[0].y1 = LV_MIN(damage[0].y1, damage[i].y1);
+        damage[0].x2 = LV_MAX(damage[0].x2, damage[i].x2);
+        damage[0].y2 = LV_MAX(damage[0].y2, damage[i].y2);
+    }
+    damage[0].x1 = LV_MIN(damage[0].x1, area->x1);
+    damage[0].y1 = LV_MIN(damage[0].y1, area->y1);
+    damage[0].x2 = LV_MAX(damage[0].x2, area->x2);
+    damage[0].y2 = LV_MAX(damage[0].y2, area->y2);
+    damage_cnt = 1;
+}
+
+/* Trim `area` down to what changed since the last frame, see diff_area() */
+static bool disp_diff(const lv_area_t *area, const lv_color_t *px,
+  lv_coord_t stride, lv_area_t *changed)
+{
+    uint64_t start = stats_now_us();
+    bool ret;
+
+    ret = diff_area(area, px, stride, changed);
+    stats_record(STAT_DIFF_US, stats_now_us() - start);
+    return ret;
+}
+
+static void *disp_flush_thread(void *arg)
+{
+    struct disp_surface *s;
+    struct disp_job j;
+    lv_area_t area, phys;
+    lv_coord_t w;
+    uint64_t start;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&job_lock);
+        while (!job_pending)
+            pthread_cond_wait(&job_cond, &job_lock);
+        j = job;
+        pthread_mutex_unlock(&job_lock);
+
+        start = stats_now_us();
+        s = backend->surface();
+        if (direct) {
+            w = j.drv->hor_res;
+            for (i = 0; i < j.damage_cnt; i++) {
+                if (!disp_diff(&j.damage[i], j.color_p +
+                  (j.damage[i].y1 * w) + j.damage[i].x1, w, &area))
+                    continue;
+                disp_damage_add(&area);
+                frame_bytes += lv_area_get_size(&area) * (s->bpp / 8);
+            }
+
+            /* LVGL has already moved on to the other page, so it has to be
+             * flipped to even if nothing changed. A single tile is the least
+             * that can be sent.
+             */
+            if (damage_cnt == 0 && j.damage_cnt > 0) {
+                area = j.damage[0];
+                area.x2 = LV_MIN(area.x2, area.x1 + DIFF_TILE - 1);
+                area.y2 = LV_MIN(area.y2, area.y1 + DIFF_TILE - 1);
+                disp_damage_add(&area);
+            }
+        } else {
+            w = lv_area_get_width(&j.area);
+            if (disp_diff(&j.area, j.color_p, w, &area)) {
+                disp_write_area(j.drv, s, &area, j.color_p +
+                  ((area.y1 - j.area.y1) * w) + (area.x1 - j.area.x1), w,
+                  &phys);
+                disp_damage_add(&phys);
+                frame_bytes += lv_area_get_size(&phys) * (s->bpp / 8);
+            }
+            start = stats_now_us() - start;
+            frame_flush_us += start;
+            stats_record(STAT_FLUSH_US, start);
+        }
+
+        if (j.last) {
+            /* If nothing changed at all, what's on screen is the frame */
+            if (damage_cnt > 0) {
+                start = stats_now_us();
+                backend->present(damage, damage_cnt);
+                stats_record(STAT_PRESENT_US, stats_now_us() - start);
+            } else {
+                stats_record(STAT_PANEL_BYTES, 0);
+            }
+            stats_record(STAT_FRAME_FLUSH_US, frame_flush_us);
+            stats_record(STAT_FLUSH_BYTES, frame_bytes);
+            damage_cnt = 0;
+            frame_bytes = 0;
+            frame_flush_us = 0;
+        }
+
+        /* lv_disp_flush_ready() only clears LVGL's flushing flags, safe from
+         * this thread. It's done under the lock along with job_pending, so
+         * the next job can't be posted in between and then cleared.
+         */
+        pthread_mutex_lock(&job_lock);
+        job_pending = false;
+        lv_disp_flush_ready(j.drv);
+        pthread_cond_signal(&done_cond);
+        pthread_mutex_unlock(&job_lock);
+
+        /* Let the loop start the next frame, see disp_paced_refresh() */
+        if (j.last && paced) {
+            atomic_store(&frame_pending, false);
+            loop_wake();
+        }
+    }
+
+    return NULL;
+}
+
+/* Hand the area off to the worker and return straight away so LVGL can
+ * start rendering the next band into the other buffer.
+ */
+static void disp_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area,
+  lv_color_t *color_p)
+{
+    bool last = lv_disp_flush_is_last(drv);
+    lv_disp_t *disp;
+    int i;
+
+    /* In direct mode the area is already on the page, and what was redrawn
+     * is only known from LVGL's invalid areas once the frame is done.
+     */
+    if (direct && !last) {
+        lv_disp_flush_ready(drv);
+        return;
+    }
+
+    if (last && paced)
+        atomic_store(&frame_pending, true);
+
+    pthread_mutex_lock(&job_lock);
+    job.drv = drv;
+    job.area = *area;
+    job.color_p = color_p;
+    job.last = last;
+    job.damage_cnt = 0;
+    if (direct) {
+        disp = _lv_refr_get_disp_refreshing();
+        for (i = 0; i < disp->inv_p; i++) {
+            if (disp->inv_area_joined[i])
+                continue;
+            if (job.damage_cnt < DISP_DAMAGE_MAX) {
+                job.damage[job.damage_cnt++] = disp->inv_areas[i];
+            } else {
+                /* Past what fits, the last one grows to cover the rest */
+                _lv_area_join(&job.damage[DISP_DAMAGE_MAX - 1],
+                  &job.damage[DISP_DAMAGE_MAX - 1], &disp->inv_areas[i]);
+            }
+        }
+    }
+    job_pending = true;
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+}
+
+/* LVGL spins on this while the buffer it wants is still being flushed, block
+ * on the worker instead of burning the CPU it needs.
+ */
+static void disp_wait_cb(lv_disp_drv_t *drv)
+{
+    uint64_t start = stats_now_us();
+
+    pthread_mutex_lock(&job_lock);
+    while (job_pending)
+        pthread_cond_wait(&done_cond, &job_lock);
+    pthread_mutex_unlock(&job_lock);
+
+    start = stats_now_us() - start;
+    refr_wait_us += start;
+    stats_record(STAT_WAIT_US, start);
+}
+
+/* Redraw whole tiles so that unchanged ones can be told apart by their hash */
+static void disp_rounder_cb(lv_disp_drv_t *drv, lv_area_t *area)
+{
+    diff_round(area);
+}
+
+static void disp_monitor_cb(lv_disp_drv_t *drv, uint32_t time, uint32_t px)
+{
+    refr_rendered = true;
+    if (time > frame_max_ms)
+        frame_max_ms = time;
+    stats_record(STAT_FRAME_MS, time);
+}
+
+uint32_t disp_frame_max_take(void)
+{
+    uint32_t max = frame_max_ms;
+
+    frame_max_ms = 0;
+    return max;
+}
+
+/* LVGL's refresh, timed so that what is spent rendering can be told apart
+ * from what is spent waiting on the flush worker.
+ */
+static void disp_refresh(lv_timer_t *timer)
+{
+    uint64_t start = stats_now_us();
+
+    refr_wait_us = 0;
+    refr_rendered = false;
+
+    _lv_disp_refr_timer(timer);
+
+    if (refr_rendered)
+        stats_record(STAT_RENDER_US, stats_now_us() - start - refr_wait_us);
+}
+
+/* With a paced backend, LVGL's own refresh timer is deleted and this runs on
+ * every pass of the main loop instead. A new frame is only started once the
+ * previous one is on screen, so frames go out at most once per flip and only
+ * when something was invalidated.
+ */
+static void disp_paced_refresh(void)
+{
+    lv_disp_t *disp = lv_disp_get_default();
+
+    if (disp->inv_p == 0 || atomic_load(&frame_pending))
+        return;
+
+    disp_refresh(NULL);
+}
+
+static const struct disp_backend *disp_backend_open(const char *name,
+  bool *rotate)
+{
+    bool want = *rotate;
+    int i;
+
+    for (i = 0; disp_backends[i] != NULL; i++) {
+        if (name != NULL && strcmp(name, disp_backends[i]->name) != 0)
+            continue;
+        *rotate = want;
+        if (disp_backends[i]->open(rotate) == 0)
+            return disp_backends[i];
+    }
+
+    if (errno == 0)
+        errno = ENODEV;
+    return NULL;
+}
+
+/* libinput scales touches to the driver's resolution, which is landscape here
+ * while the touchscreen is not. Undo that, then turn the point the same way
+ * LVGL would for LV_DISP_ROT_270.
+ */
+void disp_map_point(lv_point_t *point)
+{
+    lv_coord_t x, y;
+
+    if (!hw_rotated)
+        return;
+
+    x = point->x * DISP_HOR_RES / DISP_VER_RES;
+    y = point->y * DISP_VER_RES / DISP_HOR_RES;
+
+    point->x = y;
+    point->y = DISP_HOR_RES - 1 - x;
+}
+
+/* LVGL's direct mode renders with no stride or offset of its own, so the
+ * pages have to be exactly the size of the display and in a format its
+ * pixels can be used in as they are.
+ */
+static int disp_direct_pages(const lv_disp_drv_t *drv,
+  struct disp_surface **pages)
+{
+    int i, n;
+
+    if (backend->pages == NULL || drv->rotated != LV_DISP_ROT_NONE)
+        return 0;
+
+    n = backend->pages(pages);
+    for (i = 0; i < n; i++) {
+        if (!convert_is_copy(DISP_LV_FORMAT, pages[i]->format) ||
+          pages[i]->width != drv->hor_res ||
+          pages[i]->height != drv->ver_res ||
+          pages[i]->stride != drv->hor_res * sizeof(lv_color_t))
+            return 0;
+    }
+
+    return n;
+}
+
+lv_disp_t *disp_init(const char *name, enum disp_rotation rotation,
+  bool want_direct)
+{
+    static lv_disp_draw_buf_t disp_buf;
+    static lv_disp_drv_t disp_drv;
+    struct disp_surface *pages[2];
+    lv_color_t *buf1, *buf2;
+    pthread_t thread;
+    lv_disp_t *disp;
+    int n = 0;
+
+    errno = 0;
+    hw_rotated = (rotation == DISP_ROT_HW);
+    backend = disp_backend_open(name, &hw_rotated);
+    if (backend == NULL)
+        return NULL;
+
+    convert = convert_get(DISP_LV_FORMAT, backend->surface()->format);
+    if (convert == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    lv_disp_drv_init(&disp_drv);
+    disp_drv.draw_buf   = &disp_buf;
+    disp_drv.flush_cb   = disp_flush_cb;
+    disp_drv.wait_cb    = disp_wait_cb;
+    disp_drv.monitor_cb = disp_monitor_cb;
+    disp_drv.rounder_cb = disp_rounder_cb;
+    disp_drv.hor_res    = DISP_HOR_RES;
+    disp_drv.ver_res    = DISP_VER_RES;
+    /* The flush worker rotates as it copies. Leaving sw_rotate off keeps
+     * LVGL from rotating in small chunks and flushing them serially.
+     */
+    disp_drv.sw_rotate  = 0;
+    if (rotation == DISP_ROT_SW)
+        disp_drv.rotated = LV_DISP_ROT_270;
+
+    /* LVGL sees a plain landscape display, see disp_map_point() */
+    if (hw_rotated) {
+        disp_drv.hor_res = DISP_VER_RES;
+        disp_drv.ver_res = DISP_HOR_RES;
+    }
+
+    /* Tiles are in LVGL's coordinates, which are turned from the driver's
+     * when it rotates
+     */
+    if (disp_drv.rotated == LV_DISP_ROT_270) {
+        if (diff_init(disp_drv.ver_res, disp_drv.hor_res) != 0)
+            return NULL;
+    } else if (diff_init(disp_drv.hor_res, disp_drv.ver_res) != 0) {
+        return NULL;
+    }
+
+    if (want_direct)
+        n = disp_direct_pages(&disp_drv, pages);
+
+    if (n > 0) {
+        /* With two pages, the one not rendered into is brought up to date by
+         * the backend's present(). A new frame must not start until that is
+         * done, so the refresh is always paced then.
+         */
+        direct = true;
+        disp_drv.direct_mode = 1;
+        lv_disp_draw_buf_init(&disp_buf, pages[0]->mem,
+          (n > 1) ? pages[1]->mem : NULL, disp_drv.hor_res * disp_drv.ver_res);
+    } else {
+        buf1 = malloc(DISP_BUF_SIZE * sizeof(lv_color_t));
+        buf2 = malloc(DISP_BUF_SIZE * sizeof(lv_color_t));
+        row_buf = malloc(LV_MAX(DISP_HOR_RES, DISP_VER_RES) *
+          sizeof(lv_color_t));
+        if (buf1 == NULL || buf2 == NULL || row_buf == NULL)
+            return NULL;
+        lv_disp_draw_buf_init(&disp_buf, buf1, buf2, DISP_BUF_SIZE);
+    }
+    paced = backend->paced || direct;
+
+    if (pthread_create(&thread, NULL, disp_flush_thread, NULL) != 0)
+        return NULL;
+    pthread_setname_np(thread, "flush");
+    pthread_detach(thread);
+
+    disp = lv_disp_drv_register(&disp_drv);
+    if (disp == NULL)
+        return NULL;
+
+    if (paced) {
+        lv_timer_del(disp->refr_timer);
+        disp->refr_timer = NULL;
+        loop_set_prepare_cb(disp_paced_refresh);
+    } else {
+        lv_timer_set_cb(disp->refr_timer, disp_refresh);
+    }
+
+    return disp;
+}
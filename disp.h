@@ -0,0 +1,101 @@
+#ifndef __DISP_H__
+#define __DISP_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "convert.h"
+
+/* How the UI gets from LVGL onto the portrait panel */
+enum disp_rotation {
+    /* Landscape, rotated by the display hardware. Falls back to
+     * DISP_ROT_NATIVE if the backend can't.
+     */
+    DISP_ROT_HW,
+    /* Portrait, in the panel's own orientation. Nothing is rotated. */
+    DISP_ROT_NATIVE,
+    /* Landscape, rotated by the flush worker as it copies */
+    DISP_ROT_SW,
+};
+
+/* Open a display backend and register it as LVGL's display. The draw buffers
+ * are double buffered, with a worker thread doing the copy out to the display
+ * while LVGL renders the next band.
+ *
+ * With `direct` set, LVGL instead renders straight into the display's memory
+ * in its direct mode, if the backend and rotation allow for it. There are
+ * then no draw buffers and no copy.
+ *
+ * `backend` is "drm", "fbdev", or NULL to use the first one that works, in
+ * that order. Returns NULL on error.
+ */
+lv_disp_t *disp_init(const char *backend, enum disp_rotation rotation,
+  bool direct);
+
+/* Touch points come in relative to the panel. When the display hardware does
+ * the rotation LVGL doesn't know about it, so the point has to be turned to
+ * match the UI here. Does nothing otherwise.
+ */
+void disp_map_point(lv_point_t *point);
+
+/* The longest frame since the last call, in ms, e.g. to tell how smooth an
+ * animation was. Only for the UI thread.
+ */
+uint32_t disp_frame_max_take(void);
+
+/* Areas written in one frame that are kept track of for present(). Past this
+ * they are merged into one bounding area.
+ */
+#define DISP_DAMAGE_MAX 16
+
+/* Memory that the flush worker writes pixels into */
+struct disp_surface {
+    uint8_t *mem;           /* Pixel (0, 0) */
+    unsigned int stride;    /* Bytes per line */
+    unsigned int width;
+    unsigned int height;
+    unsigned int bpp;       /* Bits per pixel */
+    enum pix_fmt format;
+};
+
+/* Implemented by disp_fbdev.c and disp_drm.c. Everything other than open()
+ * is only called from the flush worker.
+ */
+struct disp_backend {
+    const char *name;
+
+    /* Returns -1 if the device isn't there or usable. If `rotate` is set the
+     * backend should give a landscape surface and rotate it onto the panel
+     * itself. It is cleared if the backend can't.
+     */
+    int (*open)(bool *rotate);
+
+    /* Surface to write the frame currently being rendered into */
+    struct disp_surface *(*surface)(void);
+
+    /* Pages LVGL can render straight into, in the order it should use them
+     * starting with the one that isn't on screen. present() then shows the
+     * one just rendered into and brings the other up to date. Returns how
+     * many there are, 0 if rendering has to go through draw buffers.
+     */
+    int (*pages)(struct disp_surface **pages);
+
+    /* Called once the last area of a frame has been written. `damage` is
+     * every area written during the frame, in physical coordinates, at most
+     * DISP_DAMAGE_MAX of them. May block until the frame is on screen.
+     * Records STAT_PANEL_BYTES for what the kernel has to send to the panel.
+     */
+    void (*present)(const lv_area_t *damage, int n);
+
+    /* present() is paced by the display. The refresh is then started by the
+     * main loop once the previous frame is on screen, rather than by LVGL's
+     * LV_DISP_DEF_REFR_PERIOD timer.
+     */
+    bool paced;
+};
+
+extern const struct disp_backend disp_fbdev_backend;
+#ifdef HAVE_DRM
+extern const struct disp_backend disp_drm_backend;
+#endif
+
+#endif // __DISP_H__
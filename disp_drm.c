@@ -0,0 +1,558 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "lvgl/lvgl.h"
+#include "disp.h"
+#include "stats.h"
+
+/* DRM/KMS backend. Two dumb buffers are scanned out directly and swapped
+ * with page flips, so there is no tearing and no extra copy through the
+ * kernel's fbdev emulation. The flush worker writes into the back buffer,
+ * and present() flips it on screen and waits for the flip to complete.
+ *
+ * On SPI panels every byte that goes out costs bus time, so when the driver
+ * supports it the flip is an atomic commit that carries the frame's damage
+ * as FB_DAMAGE_CLIPS. The driver then only sends the areas that changed
+ * rather than the whole frame.
+ *
+ * Where the primary plane has a "rotation" property, the buffers are laid out
+ * landscape like the UI and the display hardware rotates them onto the
+ * portrait panel, so nothing has to be rotated in software.
+ */
+
+#define DRM_CARD_PATH "/dev/dri/card0"
+
+/* Scan out in LVGL's own format, RGB565 or XRGB8888, so the flush worker only
+ * ever copies.
+ */
+#if LV_COLOR_DEPTH == 16
+#define DRM_BPP 16
+#define DRM_DEPTH 16
+#define DRM_FORMAT PIX_FMT_RGB565
+#else
+#define DRM_BPP 32
+#define DRM_DEPTH 24
+#define DRM_FORMAT PIX_FMT_XRGB8888
+#endif
+
+/* Don't hang the flush worker forever on a flip that never completes */
+#define DRM_FLIP_TIMEOUT_MS 1000
+
+struct drm_buf {
+    uint32_t handle;
+    uint32_t fb_id;
+    size_t size;
+    struct disp_surface surface;
+};
+
+static int drm_fd = -1;
+static uint32_t drm_conn_id;
+static uint32_t drm_crtc_id;
+static int drm_crtc_idx;
+static drmModeModeInfo drm_mode;
+static struct drm_buf drm_buf[2];
+static int drm_front;
+static bool drm_flip_done;
+
+/* Primary plane and its properties, only set up if damage clips are usable */
+static bool drm_damage;
+static uint32_t drm_plane_id;
+static uint32_t drm_prop_fb_id;
+static uint32_t drm_prop_damage;
+
+/* Find the first connected connector, its preferred mode, and a CRTC that can
+ * drive it.
+ */
+static int drm_find_output(void)
+{
+    drmModeRes *res;
+    drmModeConnector *conn = NULL;
+    drmModeEncoder *enc;
+    int i, j;
+
+    res = drmModeGetResources(drm_fd);
+    if (res == NULL)
+        return -1;
+
+    for (i = 0; i < res->count_connectors; i++) {
+        conn = drmModeGetConnector(drm_fd, res->connectors[i]);
+        if (conn != NULL && conn->connection == DRM_MODE_CONNECTED &&
+          conn->count_modes > 0)
+            break;
+        drmModeFreeConnector(conn);
+        conn = NULL;
+    }
+    if (conn == NULL)
+        goto out;
+
+    drm_conn_id = conn->connector_id;
+    drm_mode = conn->modes[0];
+    for (i = 0; i < conn->count_modes; i++) {
+        if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            drm_mode = conn->modes[i];
+            break;
+        }
+    }
+
+    /* Prefer the CRTC already driving the connector */
+    drm_crtc_id = 0;
+    if (conn->encoder_id != 0) {
+        enc = drmModeGetEncoder(drm_fd, conn->encoder_id);
+        if (enc != NULL) {
+            drm_crtc_id = enc->crtc_id;
+            drmModeFreeEncoder(enc);
+        }
+    }
+
+    for (i = 0; drm_crtc_id == 0 && i < conn->count_encoders; i++) {
+        enc = drmModeGetEncoder(drm_fd, conn->encoders[i]);
+        if (enc == NULL)
+            continue;
+        for (j = 0; j < res->count_crtcs; j++) {
+            if (enc->possible_crtcs & (1 << j)) {
+                drm_crtc_id = res->crtcs[j];
+                break;
+            }
+        }
+        drmModeFreeEncoder(enc);
+    }
+
+    /* Planes refer to CRTCs by index rather than ID */
+    for (i = 0; i < res->count_crtcs; i++) {
+        if (res->crtcs[i] == drm_crtc_id)
+            drm_crtc_idx = i;
+    }
+
+    drmModeFreeConnector(conn);
+out:
+    drmModeFreeResources(res);
+    return drm_crtc_id != 0 ? 0 : -1;
+}
+
+/* Returns the ID of the named property of a KMS object, or 0 if it has none */
+static uint32_t drm_prop_find(uint32_t obj_id, uint32_t obj_type,
+  const char *name, uint64_t *value)
+{
+    drmModeObjectProperties *props;
+    drmModePropertyRes *prop;
+    uint32_t id = 0;
+    uint32_t i;
+
+    props = drmModeObjectGetProperties(drm_fd, obj_id, obj_type);
+    if (props == NULL)
+        return 0;
+
+    for (i = 0; id == 0 && i < props->count_props; i++) {
+        prop = drmModeGetProperty(drm_fd, props->props[i]);
+        if (prop == NULL)
+            continue;
+        if (strcmp(prop->name, name) == 0) {
+            id = prop->prop_id;
+            if (value != NULL)
+                *value = props->prop_values[i];
+        }
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+/* Find the CRTC's primary plane and check that it takes damage clips. Left
+ * off on older kernels and drivers, which then get the legacy flip and no
+ * rotation.
+ */
+static void drm_plane_init(void)
+{
+    drmModePlaneRes *res;
+    drmModePlane *plane;
+    uint64_t type;
+    uint32_t i;
+
+    if (drmSetClientCap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)
+        return;
+
+    res = drmModeGetPlaneResources(drm_fd);
+    if (res == NULL)
+        return;
+
+    for (i = 0; drm_plane_id == 0 && i < res->count_planes; i++) {
+        plane = drmModeGetPlane(drm_fd, res->planes[i]);
+        if (plane == NULL)
+            continue;
+        if ((plane->possible_crtcs & (1 << drm_crtc_idx)) &&
+          drm_prop_find(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type",
+          &type) != 0 && type == DRM_PLANE_TYPE_PRIMARY)
+            drm_plane_id = plane->plane_id;
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(res);
+
+    if (drm_plane_id == 0)
+        return;
+
+    drm_prop_fb_id = drm_prop_find(drm_plane_id, DRM_MODE_OBJECT_PLANE,
+      "FB_ID", NULL);
+    drm_prop_damage = drm_prop_find(drm_plane_id, DRM_MODE_OBJECT_PLANE,
+      "FB_DAMAGE_CLIPS", NULL);
+    drm_damage = (drm_prop_fb_id != 0 && drm_prop_damage != 0);
+}
+
+/* Whether the primary plane can scan out rotated by 270 degrees. DRM counts
+ * rotation counter-clockwise, so this turns the landscape UI clockwise onto
+ * the portrait panel, the same way LV_DISP_ROT_270 does.
+ */
+static bool drm_plane_can_rotate(void)
+{
+    drmModePropertyRes *prop;
+    uint32_t id;
+    bool ret = false;
+    int i;
+
+    if (drm_plane_id == 0)
+        return false;
+
+    id = drm_prop_find(drm_plane_id, DRM_MODE_OBJECT_PLANE, "rotation", NULL);
+    if (id == 0)
+        return false;
+
+    prop = drmModeGetProperty(drm_fd, id);
+    if (prop == NULL)
+        return false;
+    for (i = 0; i < prop->count_enums; i++) {
+        if (strcmp(prop->enums[i].name, "rotate-270") == 0)
+            ret = true;
+    }
+    drmModeFreeProperty(prop);
+
+    return ret;
+}
+
+/* Light up the output with the primary plane scanning out `buf` rotated onto
+ * the panel. This has to be a single atomic commit, legacy SetCrtc checks the
+ * buffer's size against the mode before any plane rotation is applied.
+ */
+static int drm_rotated_modeset(const struct drm_buf *buf)
+{
+    struct {
+        uint32_t obj;
+        uint32_t type;
+        const char *name;
+        uint64_t value;
+    } props[] = {
+        { drm_conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", drm_crtc_id },
+        { drm_crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", 0 },
+        { drm_crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", buf->fb_id },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID", drm_crtc_id },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X", 0 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y", 0 },
+        /* 16.16 fixed point */
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W",
+          (uint64_t)buf->surface.width << 16 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H",
+          (uint64_t)buf->surface.height << 16 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X", 0 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y", 0 },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W", drm_mode.hdisplay },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H", drm_mode.vdisplay },
+        { drm_plane_id, DRM_MODE_OBJECT_PLANE, "rotation",
+          DRM_MODE_ROTATE_270 },
+        { 0 },
+    };
+    drmModeAtomicReq *req;
+    uint32_t mode_blob, id;
+    int i, ret = -1;
+
+    if (drmModeCreatePropertyBlob(drm_fd, &drm_mode, sizeof(drm_mode),
+      &mode_blob) != 0)
+        return -1;
+    props[1].value = mode_blob;
+
+    req = drmModeAtomicAlloc();
+    if (req == NULL)
+        goto out;
+
+    for (i = 0; props[i].name != NULL; i++) {
+        id = drm_prop_find(props[i].obj, props[i].type, props[i].name, NULL);
+        if (id == 0)
+            goto out_req;
+        drmModeAtomicAddProperty(req, props[i].obj, id, props[i].value);
+    }
+
+    ret = drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET,
+      NULL);
+
+out_req:
+    drmModeAtomicFree(req);
+out:
+    drmModeDestroyPropertyBlob(drm_fd, mode_blob);
+    return ret;
+}
+
+static void drm_buf_destroy(struct drm_buf *buf)
+{
+    struct drm_mode_destroy_dumb dreq = { .handle = buf->handle };
+
+    if (buf->surface.mem != NULL)
+        munmap(buf->surface.mem, buf->size);
+    if (buf->fb_id != 0)
+        drmModeRmFB(drm_fd, buf->fb_id);
+    drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static int drm_buf_create(struct drm_buf *buf, unsigned int width,
+  unsigned int height)
+{
+    struct drm_mode_create_dumb creq;
+    struct drm_mode_map_dumb mreq;
+    uint8_t *mem;
+
+    memset(&creq, 0, sizeof(creq));
+    creq.width = width;
+    creq.height = height;
+    creq.bpp = DRM_BPP;
+    if (drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) == -1)
+        return -1;
+    buf->handle = creq.handle;
+    buf->size = creq.size;
+
+    if (drmModeAddFB(drm_fd, creq.width, creq.height, DRM_DEPTH, DRM_BPP,
+      creq.pitch, creq.handle, &buf->fb_id) != 0)
+        goto out;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.handle = creq.handle;
+    if (drmIoctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) == -1)
+        goto out;
+
+    mem = mmap(NULL, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd,
+      mreq.offset);
+    if (mem == MAP_FAILED)
+        goto out;
+    memset(mem, 0, creq.size);
+
+    buf->surface.mem = mem;
+    buf->surface.stride = creq.pitch;
+    buf->surface.width = creq.width;
+    buf->surface.height = creq.height;
+    buf->surface.bpp = creq.bpp;
+    buf->surface.format = DRM_FORMAT;
+
+    return 0;
+
+out:
+    drm_buf_destroy(buf);
+    return -1;
+}
+
+static int drm_bufs_create(unsigned int width, unsigned int height)
+{
+    if (drm_buf_create(&drm_buf[0], width, height) == -1)
+        return -1;
+    if (drm_buf_create(&drm_buf[1], width, height) == -1) {
+        drm_buf_destroy(&drm_buf[0]);
+        return -1;
+    }
+    drm_front = 0;
+
+    return 0;
+}
+
+static void drm_bufs_destroy(void)
+{
+    drm_buf_destroy(&drm_buf[1]);
+    drm_buf_destroy(&drm_buf[0]);
+}
+
+static int drm_open(bool *rotate)
+{
+    uint64_t has_dumb = 0;
+
+    drm_fd = open(DRM_CARD_PATH, O_RDWR | O_CLOEXEC);
+    if (drm_fd == -1)
+        return -1;
+
+    if (drmGetCap(drm_fd, DRM_CAP_DUMB_BUFFER, &has_dumb) == -1 || !has_dumb)
+        goto out;
+
+    if (drm_find_output() == -1)
+        goto out;
+
+    drm_plane_init();
+
+    /* Buffers are laid out the way the UI is, landscape, and the plane turns
+     * them onto the panel while scanning out.
+     */
+    if (*rotate && drm_plane_can_rotate()) {
+        if (drm_bufs_create(drm_mode.vdisplay, drm_mode.hdisplay) == 0) {
+            if (drm_rotated_modeset(&drm_buf[0]) == 0)
+                return 0;
+            drm_bufs_destroy();
+        }
+    }
+    *rotate = false;
+
+    if (drm_bufs_create(drm_mode.hdisplay, drm_mode.vdisplay) == -1)
+        goto out;
+
+    /* Fails if something else, e.g. the fbdev console, is DRM master */
+    if (drmModeSetCrtc(drm_fd, drm_crtc_id, drm_buf[0].fb_id, 0, 0,
+      &drm_conn_id, 1, &drm_mode) != 0)
+        goto out_buf;
+
+    return 0;
+
+out_buf:
+    drm_bufs_destroy();
+out:
+    close(drm_fd);
+    drm_fd = -1;
+    return -1;
+}
+
+static struct disp_surface *drm_get_surface(void)
+{
+    return &drm_buf[!drm_front].surface;
+}
+
+/* LVGL renders straight into the back buffer and present() flips it, as long
+ * as the buffers are laid out the way LVGL expects, no padding at the end of
+ * lines.
+ */
+static int drm_get_pages(struct disp_surface **pages)
+{
+    struct disp_surface *s = &drm_buf[0].surface;
+
+    if (s->stride != s->width * (s->bpp / 8))
+        return 0;
+
+    pages[0] = &drm_buf[!drm_front].surface;
+    pages[1] = &drm_buf[drm_front].surface;
+    return 2;
+}
+
+static void drm_page_flip_handler(int fd, unsigned int sequence,
+  unsigned int tv_sec, unsigned int tv_usec, void *user_data)
+{
+    drm_flip_done = true;
+}
+
+static void drm_copy_area(struct disp_surface *dst,
+  const struct disp_surface *src, const lv_area_t *area)
+{
+    size_t off, len;
+    int y;
+
+    len = lv_area_get_width(area) * (src->bpp / 8);
+    for (y = area->y1; y <= area->y2; y++) {
+        off = (y * src->stride) + (area->x1 * (src->bpp / 8));
+        memcpy(dst->mem + off, src->mem + off, len);
+    }
+}
+
+/* Flip to `fb_id` with an atomic commit that only updates the plane's FB and
+ * damage. Damage is relative to what is on screen, which the back buffer
+ * matches outside of the damaged areas, see drm_present().
+ */
+static int drm_damage_flip(uint32_t fb_id, const lv_area_t *damage, int n)
+{
+    struct drm_mode_rect clips[DISP_DAMAGE_MAX];
+    drmModeAtomicReq *req;
+    uint32_t blob;
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        clips[i].x1 = damage[i].x1;
+        clips[i].y1 = damage[i].y1;
+        clips[i].x2 = damage[i].x2 + 1;
+        clips[i].y2 = damage[i].y2 + 1;
+    }
+
+    if (drmModeCreatePropertyBlob(drm_fd, clips, n * sizeof(clips[0]),
+      &blob) != 0)
+        return -1;
+
+    req = drmModeAtomicAlloc();
+    if (req == NULL) {
+        drmModeDestroyPropertyBlob(drm_fd, blob);
+        return -1;
+    }
+
+    drmModeAtomicAddProperty(req, drm_plane_id, drm_prop_fb_id, fb_id);
+    drmModeAtomicAddProperty(req, drm_plane_id, drm_prop_damage, blob);
+    ret = drmModeAtomicCommit(drm_fd, req,
+      DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, NULL);
+
+    /* The committed state holds its own reference to the blob */
+    drmModeAtomicFree(req);
+    drmModeDestroyPropertyBlob(drm_fd, blob);
+    return ret;
+}
+
+static void drm_present(const lv_area_t *damage, int n)
+{
+    drmEventContext ev = {
+        .version = DRM_EVENT_CONTEXT_VERSION,
+        .page_flip_handler = drm_page_flip_handler,
+    };
+    struct pollfd pfd = { .fd = drm_fd, .events = POLLIN };
+    int back = !drm_front;
+    struct disp_surface *s = &drm_buf[back].surface;
+    size_t bytes = 0;
+    int i, ret = -1;
+
+    drm_flip_done = false;
+    if (drm_damage) {
+        ret = drm_damage_flip(drm_buf[back].fb_id, damage, n);
+        for (i = 0; ret == 0 && i < n; i++)
+            bytes += lv_area_get_size(&damage[i]) * (s->bpp / 8);
+
+        /* Don't keep trying a commit the driver has turned down */
+        if (ret != 0)
+            drm_damage = false;
+    }
+    if (ret != 0) {
+        ret = drmModePageFlip(drm_fd, drm_crtc_id, drm_buf[back].fb_id,
+          DRM_MODE_PAGE_FLIP_EVENT, NULL);
+        bytes = (size_t)s->stride * s->height;
+    }
+
+    if (ret == 0) {
+        while (!drm_flip_done) {
+            if (poll(&pfd, 1, DRM_FLIP_TIMEOUT_MS) <= 0)
+                break;
+            drmHandleEvent(drm_fd, &ev);
+        }
+    } else {
+        /* Not every driver can flip, still get the frame on screen */
+        drmModeSetCrtc(drm_fd, drm_crtc_id, drm_buf[back].fb_id, 0, 0,
+          &drm_conn_id, 1, &drm_mode);
+    }
+    drm_front = back;
+    stats_record(STAT_PANEL_BYTES, bytes);
+
+    /* LVGL only redraws what changed, so the new back buffer has to catch up
+     * on the frame that was just drawn into the other one.
+     */
+    for (i = 0; i < n; i++)
+        drm_copy_area(&drm_buf[!drm_front].surface,
+          &drm_buf[drm_front].surface, &damage[i]);
+}
+
+const struct disp_backend disp_drm_backend = {
+    .name = "drm",
+    .open = drm_open,
+    .surface = drm_get_surface,
+    .pages = drm_get_pages,
+    .present = drm_present,
+    .paced = true,
+};
@@ -0,0 +1,199 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fb.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "lvgl/lvgl.h"
+#include "lv_drv_conf.h"
+#include "disp.h"
+#include "stats.h"
+
+/* The fbdev device, usually emulated by the kernel's DRM layer. Writes to the
+ * mapping are shown directly, there is nothing to present.
+ *
+ * If the virtual resolution is at least twice the visible one, e.g. the DRM
+ * emulation with drm_kms_helper.drm_fbdev_overalloc=200, the two halves are
+ * used as pages. Frames are drawn to the hidden one and panned to.
+ *
+ * fbdev has no way to pass damage along. The DRM emulation tracks writes to
+ * the mapping itself and sends whole lines on to the panel, so the most that
+ * can be done is to only write what LVGL invalidated.
+ */
+
+static int fbdev_fd = -1;
+static struct fb_var_screeninfo fbdev_vinfo;
+static struct disp_surface fbdev_page[2];
+static int fbdev_pages;
+static int fbdev_front;
+
+/* One flag per line, for working out which lines a frame touched */
+static uint8_t *fbdev_lines;
+
+/* Work out the format from the channel layout the driver reports */
+static enum pix_fmt fbdev_format(const struct fb_var_screeninfo *vinfo)
+{
+    if (vinfo->red.offset != (vinfo->green.offset + vinfo->green.length) ||
+      vinfo->green.offset != (vinfo->blue.offset + vinfo->blue.length) ||
+      vinfo->blue.offset != 0)
+        return PIX_FMT_NONE;
+
+    switch (vinfo->bits_per_pixel) {
+    case 16:
+        return (vinfo->green.length == 6) ? PIX_FMT_RGB565 : PIX_FMT_NONE;
+    case 24:
+        return PIX_FMT_RGB888;
+    case 32:
+        return (vinfo->transp.length == 8) ? PIX_FMT_ARGB8888 :
+          PIX_FMT_XRGB8888;
+    default:
+        return PIX_FMT_NONE;
+    }
+}
+
+/* fbdev can't rotate, `rotate` is always cleared */
+static int fbdev_open(bool *rotate)
+{
+    struct fb_fix_screeninfo finfo;
+    struct fb_var_screeninfo *vinfo = &fbdev_vinfo;
+    uint8_t *mem;
+    int fd, i;
+
+    *rotate = false;
+
+    fd = open(FBDEV_PATH, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1 ||
+      ioctl(fd, FBIOGET_VSCREENINFO, vinfo) == -1)
+        goto out;
+
+    if (fbdev_format(vinfo) == PIX_FMT_NONE)
+        goto out;
+
+    mem = mmap(NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+    if (mem == MAP_FAILED)
+        goto out;
+
+    fbdev_pages = (vinfo->yres_virtual >= (vinfo->yres * 2) &&
+      finfo.ypanstep != 0) ? 2 : 1;
+    for (i = 0; i < fbdev_pages; i++) {
+        fbdev_page[i].stride = finfo.line_length;
+        fbdev_page[i].width = vinfo->xres;
+        fbdev_page[i].height = vinfo->yres;
+        fbdev_page[i].bpp = vinfo->bits_per_pixel;
+        fbdev_page[i].format = fbdev_format(vinfo);
+        fbdev_page[i].mem = mem + (i * vinfo->yres * finfo.line_length) +
+          (vinfo->xoffset * (vinfo->bits_per_pixel / 8));
+    }
+
+    /* Start out showing the first page */
+    fbdev_front = 0;
+    if (fbdev_pages == 2) {
+        vinfo->yoffset = 0;
+        if (ioctl(fd, FBIOPAN_DISPLAY, vinfo) == -1)
+            fbdev_pages = 1;
+    } else {
+        fbdev_page[0].mem += vinfo->yoffset * finfo.line_length;
+    }
+
+    fbdev_lines = calloc(vinfo->yres, 1);
+    if (fbdev_lines == NULL)
+        goto out_unmap;
+
+    /* The mapping stays valid after the fd is closed, it is only kept open
+     * for panning.
+     */
+    if (fbdev_pages == 2)
+        fbdev_fd = fd;
+    else
+        close(fd);
+    return 0;
+
+out_unmap:
+    munmap(mem, finfo.smem_len);
+
+out:
+    close(fd);
+    return -1;
+}
+
+static struct disp_surface *fbdev_get_surface(void)
+{
+    return &fbdev_page[(fbdev_pages == 2) ? !fbdev_front : 0];
+}
+
+static int fbdev_get_pages(struct disp_surface **pages)
+{
+    if (fbdev_pages == 2) {
+        pages[0] = &fbdev_page[!fbdev_front];
+        pages[1] = &fbdev_page[fbdev_front];
+    } else {
+        pages[0] = &fbdev_page[0];
+    }
+
+    return fbdev_pages;
+}
+
+/* Account for the lines the emulation will send */
+static void fbdev_account(const lv_area_t *damage, int n)
+{
+    unsigned int lines = 0;
+    int i, y;
+
+    if (!stats_enabled())
+        return;
+
+    for (i = 0; i < n; i++) {
+        for (y = damage[i].y1; y <= damage[i].y2; y++) {
+            lines += !fbdev_lines[y];
+            fbdev_lines[y] = 1;
+        }
+    }
+    memset(fbdev_lines, 0, fbdev_page[0].height);
+
+    stats_record(STAT_PANEL_BYTES, lines * fbdev_page[0].stride);
+}
+
+/* With a single page there is nothing to do but the accounting. With two,
+ * pan to the one just drawn and bring the other up to date with it, since
+ * LVGL only redraws what changed.
+ */
+static void fbdev_present(const lv_area_t *damage, int n)
+{
+    struct disp_surface *src, *dst;
+    size_t off, len;
+    int i, y;
+
+    if (fbdev_pages == 2) {
+        fbdev_front = !fbdev_front;
+        fbdev_vinfo.yoffset = fbdev_front * fbdev_vinfo.yres;
+        ioctl(fbdev_fd, FBIOPAN_DISPLAY, &fbdev_vinfo);
+
+        src = &fbdev_page[fbdev_front];
+        dst = &fbdev_page[!fbdev_front];
+        for (i = 0; i < n; i++) {
+            len = lv_area_get_width(&damage[i]) * (src->bpp / 8);
+            for (y = damage[i].y1; y <= damage[i].y2; y++) {
+                off = (y * src->stride) + (damage[i].x1 * (src->bpp / 8));
+                memcpy(dst->mem + off, src->mem + off, len);
+            }
+        }
+    }
+
+    fbdev_account(damage, n);
+}
+
+const struct disp_backend disp_fbdev_backend = {
+    .name = "fbdev",
+    .open = fbdev_open,
+    .surface = fbdev_get_surface,
+    .pages = fbdev_get_pages,
+    .present = fbdev_present,
+    .paced = false,
+};
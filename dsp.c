@@ -0,0 +1,294 @@
+#include <string.h>
+
+/* Built with NO_SIMD, only the plain C path is used */
+#if !defined(NO_SIMD) && defined(__ARM_NEON)
+#define DSP_NEON
+#include <arm_neon.h>
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define DSP_SSE2
+#include <immintrin.h>
+#endif
+
+#include "dsp.h"
+
+#define DSP_ALPHA_SHIFT 10
+
+/* Bits a sample takes up once in fixed point, see the limit in dsp.h */
+#define DSP_SAMPLE_BITS (16 + DSP_FRAC_BITS)
+
+/* One vector of DSP_LANES samples, and the handful of operations the chain
+ * needs on it. Adds and subtracts wrap, which the CIC relies on.
+ */
+#if defined(DSP_NEON)
+typedef int32x4_t dsp_v;
+
+static inline dsp_v v_load(const int32_t *p) { return vld1q_s32(p); }
+static inline void v_store(int32_t *p, dsp_v a) { vst1q_s32(p, a); }
+static inline dsp_v v_dup(int32_t x) { return vdupq_n_s32(x); }
+static inline dsp_v v_add(dsp_v a, dsp_v b) { return vaddq_s32(a, b); }
+static inline dsp_v v_sub(dsp_v a, dsp_v b) { return vsubq_s32(a, b); }
+static inline dsp_v v_mul(dsp_v a, dsp_v b) { return vmulq_s32(a, b); }
+static inline dsp_v v_min(dsp_v a, dsp_v b) { return vminq_s32(a, b); }
+static inline dsp_v v_max(dsp_v a, dsp_v b) { return vmaxq_s32(a, b); }
+
+static inline dsp_v v_sra(dsp_v a, unsigned int n)
+{
+    return vshlq_s32(a, vdupq_n_s32(-(int32_t)n));
+}
+
+static inline dsp_v v_shl(dsp_v a, unsigned int n)
+{
+    return vshlq_s32(a, vdupq_n_s32(n));
+}
+
+/* Lanes of `a` where `mask` is all ones, of `b` where it is 0 */
+static inline dsp_v v_sel(dsp_v mask, dsp_v a, dsp_v b)
+{
+    return vbslq_s32(vreinterpretq_u32_s32(mask), a, b);
+}
+#elif defined(DSP_SSE2)
+typedef __m128i dsp_v;
+
+static inline dsp_v v_load(const int32_t *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void v_store(int32_t *p, dsp_v a)
+{
+    _mm_storeu_si128((__m128i *)p, a);
+}
+
+static inline dsp_v v_dup(int32_t x) { return _mm_set1_epi32(x); }
+static inline dsp_v v_add(dsp_v a, dsp_v b) { return _mm_add_epi32(a, b); }
+static inline dsp_v v_sub(dsp_v a, dsp_v b) { return _mm_sub_epi32(a, b); }
+
+static inline dsp_v v_sra(dsp_v a, unsigned int n)
+{
+    return _mm_sra_epi32(a, _mm_cvtsi32_si128(n));
+}
+
+static inline dsp_v v_shl(dsp_v a, unsigned int n)
+{
+    return _mm_sll_epi32(a, _mm_cvtsi32_si128(n));
+}
+
+static inline dsp_v v_sel(dsp_v mask, dsp_v a, dsp_v b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* No 32 bit multiply, min or max before SSE4.1. The low half of the unsigned
+ * 64 bit products of the even and odd lanes is the same as the signed one.
+ */
+static inline dsp_v v_mul(dsp_v a, dsp_v b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline dsp_v v_min(dsp_v a, dsp_v b)
+{
+    return v_sel(_mm_cmpgt_epi32(a, b), b, a);
+}
+
+static inline dsp_v v_max(dsp_v a, dsp_v b)
+{
+    return v_sel(_mm_cmpgt_epi32(a, b), a, b);
+}
+#else
+typedef struct {
+    int32_t l[DSP_LANES];
+} dsp_v;
+
+/* Lane by lane, in unsigned where it has to wrap */
+#define DSP_V_FN(name, args, expr) \
+    static inline dsp_v name args \
+    { \
+        dsp_v r; \
+        unsigned int i; \
+        for (i = 0; i < DSP_LANES; i++) \
+            r.l[i] = (expr); \
+        return r; \
+    }
+
+DSP_V_FN(v_load, (const int32_t *p), p[i])
+DSP_V_FN(v_dup, (int32_t x), x)
+DSP_V_FN(v_add, (dsp_v a, dsp_v b), (uint32_t)a.l[i] + (uint32_t)b.l[i])
+DSP_V_FN(v_sub, (dsp_v a, dsp_v b), (uint32_t)a.l[i] - (uint32_t)b.l[i])
+DSP_V_FN(v_mul, (dsp_v a, dsp_v b), (uint32_t)a.l[i] * (uint32_t)b.l[i])
+DSP_V_FN(v_min, (dsp_v a, dsp_v b), a.l[i] < b.l[i] ? a.l[i] : b.l[i])
+DSP_V_FN(v_max, (dsp_v a, dsp_v b), a.l[i] > b.l[i] ? a.l[i] : b.l[i])
+DSP_V_FN(v_sra, (dsp_v a, unsigned int n), a.l[i] >> n)
+DSP_V_FN(v_shl, (dsp_v a, unsigned int n), (uint32_t)a.l[i] << n)
+DSP_V_FN(v_sel, (dsp_v mask, dsp_v a, dsp_v b), mask.l[i] ? a.l[i] : b.l[i])
+
+static inline void v_store(int32_t *p, dsp_v a)
+{
+    memcpy(p, a.l, sizeof(a.l));
+}
+#endif
+
+/* Right shift, rounding to nearest */
+static inline dsp_v v_sra_round(dsp_v a, unsigned int n)
+{
+    if (n == 0)
+        return a;
+    return v_sra(v_add(a, v_dup(1 << (n - 1))), n);
+}
+
+static int dsp_log2(unsigned int x)
+{
+    int n = 0;
+
+    if (x == 0 || (x & (x - 1)) != 0)
+        return -1;
+    while (x >>= 1)
+        n++;
+
+    return n;
+}
+
+int dsp_init(struct dsp *dsp, const struct dsp_cfg *cfg)
+{
+    int box_shift, cic_shift;
+    unsigned int i;
+
+    box_shift = dsp_log2(cfg->boxcar);
+    cic_shift = dsp_log2(cfg->cic_rate);
+    if (box_shift == -1 || cic_shift == -1)
+        return -1;
+
+    /* The boxcar's sum, and the CIC's gain of rate ^ order, must fit with
+     * room for the sign and rounding.
+     */
+    if (DSP_SAMPLE_BITS + box_shift > 30)
+        return -1;
+    if (cfg->cic_rate > 1) {
+        if (cfg->cic_order == 0 || cfg->cic_order > DSP_CIC_ORDER_MAX)
+            return -1;
+        cic_shift *= cfg->cic_order;
+        if (DSP_SAMPLE_BITS + cic_shift > 30)
+            return -1;
+    }
+
+    for (i = 0; i < DSP_LANES; i++) {
+        if (cfg->chan[i].alpha == 0 || cfg->chan[i].alpha > DSP_ALPHA_ONE)
+            return -1;
+    }
+
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->cfg = *cfg;
+    dsp->box_shift = box_shift;
+    dsp->cic_shift = cic_shift;
+    /* Until the integrators have seen a whole window, a CIC's output is a
+     * ramp up from 0, not the signal.
+     */
+    if (cfg->cic_rate > 1)
+        dsp->cic_skip = cfg->cic_order - 1;
+
+    for (i = 0; i < DSP_LANES; i++) {
+        dsp->med_mask[i] = cfg->chan[i].median ? -1 : 0;
+        dsp->alpha[i] = cfg->chan[i].alpha;
+    }
+
+    return 0;
+}
+
+unsigned int dsp_run(struct dsp *dsp, const int32_t *in, unsigned int n,
+  int32_t *out, unsigned int *out_at)
+{
+    const struct dsp_cfg *cfg = &dsp->cfg;
+    dsp_v integ[DSP_CIC_ORDER_MAX], comb[DSP_CIC_ORDER_MAX];
+    dsp_v med_mask, alpha, m0, m1, box, y;
+    dsp_v x, lo, hi, c, t;
+    unsigned int s, k, m = 0;
+
+    if (n == 0)
+        return 0;
+
+    /* The state lives in registers for the length of the run */
+    med_mask = v_load(dsp->med_mask);
+    alpha = v_load(dsp->alpha);
+    box = v_load(dsp->box);
+    y = v_load(dsp->iir);
+    for (k = 0; k < cfg->cic_order && k < DSP_CIC_ORDER_MAX; k++) {
+        integ[k] = v_load(dsp->integ[k]);
+        comb[k] = v_load(dsp->comb[k]);
+    }
+
+    if (!dsp->primed) {
+        v_store(dsp->med[0], v_shl(v_load(in), DSP_FRAC_BITS));
+        v_store(dsp->med[1], v_load(dsp->med[0]));
+        dsp->primed = true;
+    }
+    m0 = v_load(dsp->med[0]);
+    m1 = v_load(dsp->med[1]);
+
+    for (s = 0; s < n; s++) {
+        x = v_shl(v_load(in + (s * DSP_LANES)), DSP_FRAC_BITS);
+
+        /* Median of the last 3, i.e. of the previous sample and either side */
+        lo = v_min(m1, x);
+        hi = v_max(m1, x);
+        t = v_max(lo, v_min(hi, m0));
+        m0 = m1;
+        m1 = x;
+        x = v_sel(med_mask, t, x);
+
+        if (cfg->boxcar > 1) {
+            box = v_add(box, x);
+            if (++dsp->box_cnt < cfg->boxcar)
+                continue;
+            dsp->box_cnt = 0;
+            x = v_sra_round(box, dsp->box_shift);
+            box = v_dup(0);
+        }
+
+        if (cfg->cic_rate > 1) {
+            integ[0] = v_add(integ[0], x);
+            for (k = 1; k < cfg->cic_order; k++)
+                integ[k] = v_add(integ[k], integ[k - 1]);
+            if (++dsp->cic_cnt < cfg->cic_rate)
+                continue;
+            dsp->cic_cnt = 0;
+
+            c = integ[cfg->cic_order - 1];
+            for (k = 0; k < cfg->cic_order; k++) {
+                t = v_sub(c, comb[k]);
+                comb[k] = c;
+                c = t;
+            }
+            if (dsp->cic_skip > 0) {
+                dsp->cic_skip--;
+                continue;
+            }
+            x = v_sra_round(c, dsp->cic_shift);
+        }
+
+        if (!dsp->iir_primed) {
+            y = x;
+            dsp->iir_primed = true;
+        } else {
+            y = v_add(y, v_sra_round(v_mul(v_sub(x, y), alpha),
+              DSP_ALPHA_SHIFT));
+        }
+
+        v_store(out + (m * DSP_LANES), v_sra_round(y, DSP_FRAC_BITS));
+        out_at[m++] = s;
+    }
+
+    v_store(dsp->med[0], m0);
+    v_store(dsp->med[1], m1);
+    v_store(dsp->box, box);
+    v_store(dsp->iir, y);
+    for (k = 0; k < cfg->cic_order && k < DSP_CIC_ORDER_MAX; k++) {
+        v_store(dsp->integ[k], integ[k]);
+        v_store(dsp->comb[k], comb[k]);
+    }
+
+    return m;
+}
@@ -0,0 +1,73 @@
+#ifndef __DSP_H__
+#define __DSP_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Streaming filter chain for ADC samples, run on DSP_LANES channels at once
+ * so that each step is one vector operation across the channels. In order:
+ *
+ *   median   3 tap median of the input, rejects single sample spikes
+ *   boxcar   mean of every `boxcar` samples, decimating by as much
+ *   CIC      `cic_order` stage CIC, decimating by `cic_rate`
+ *   IIR      single pole low pass, y += (x - y) * alpha
+ *
+ * The channels are decimated in lockstep, so the rates are shared, while
+ * median and the IIR's alpha are set per channel. Everything is fixed point,
+ * with 4 fractional bits carried through the chain so that averaging gains
+ * resolution rather than throwing it away. Samples must stay within 16 bits
+ * of whole units, i.e. +/-32767 mV or uA.
+ *
+ * Uses NEON or SSE2 where the compiler targets them.
+ */
+#define DSP_LANES 4
+
+/* IIR alpha is in 1/DSP_ALPHA_ONE, DSP_ALPHA_ONE passes straight through */
+#define DSP_ALPHA_ONE 1024
+
+#define DSP_CIC_ORDER_MAX 3
+
+struct dsp_chan_cfg {
+    bool median;
+    uint16_t alpha;
+};
+
+struct dsp_cfg {
+    unsigned int boxcar;        /* power of 2, 1 to not decimate */
+    unsigned int cic_rate;      /* power of 2, 1 to skip the CIC */
+    unsigned int cic_order;
+    struct dsp_chan_cfg chan[DSP_LANES];
+};
+
+/* Filter state, one int32_t per lane for each. Samples carry DSP_FRAC_BITS
+ * of fraction from the median on.
+ */
+#define DSP_FRAC_BITS 4
+
+struct dsp {
+    struct dsp_cfg cfg;
+    int32_t med_mask[DSP_LANES];
+    int32_t med[2][DSP_LANES];
+    int32_t box[DSP_LANES];
+    int32_t integ[DSP_CIC_ORDER_MAX][DSP_LANES];
+    int32_t comb[DSP_CIC_ORDER_MAX][DSP_LANES];
+    int32_t alpha[DSP_LANES];
+    int32_t iir[DSP_LANES];
+    unsigned int box_cnt, box_shift;
+    unsigned int cic_cnt, cic_shift, cic_skip;
+    bool primed, iir_primed;
+};
+
+/* Start from a clean state, e.g. after a gap in the samples. Returns -1 if
+ * the config isn't valid, e.g. the CIC's gain wouldn't fit in 32 bits.
+ */
+int dsp_init(struct dsp *dsp, const struct dsp_cfg *cfg);
+
+/* Run `n` scans of DSP_LANES interleaved samples through the chain. Each
+ * output scan is written to `out`, and the index of the input scan that
+ * completed it to `out_at`, for timestamping. `out` and `out_at` need room
+ * for `n` scans. Returns how many scans were output.
+ */
+unsigned int dsp_run(struct dsp *dsp, const int32_t *in, unsigned int n,
+  int32_t *out, unsigned int *out_at);
+
+#endif // __DSP_H__
@@ -1,10 +1,17 @@
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "lvgl/lvgl.h"
 
+#include "cap.h"
 #include "gpiolib1.h"
+#include "io.h"
+#include "la.h"
 #include "main.h"
 #include "gpio.h"
+#include "seq.h"
 
 /* Styles used for these buttons */
 static lv_style_t style_relay_btn;
@@ -18,6 +25,8 @@ struct gpio_desc {
     lv_style_t *style;
     void *gpio;
     lv_obj_t *obj;
+    /* Sequencer program to run once claimed, from gpio_seq_add() */
+    struct seq_prog *seq;
 };
 
 static struct gpio_desc gpio_relay_desc[] = {
@@ -38,8 +47,21 @@ static struct gpio_desc gpio_hs_desc[] = {
     {},
 };
 
+/* The HV inputs can be noisy. Their edges are all captured, unfiltered, for
+ * the logic analyzer, and the LEDs only follow a level once it has held for
+ * this long.
+ */
+#define GPIO_LED_SETTLE_MS 5
+
+/* Most lines claimed together in one request, and written in one go */
+#define GPIO_GROUP_MAX IO_GPIO_MAX
+
 struct gpio_out_group {
     struct gpio_desc *desc;
+    /* Set by a long press, the change that follows on release is applied to
+     * every button of the group at once.
+     */
+    bool together;
 };
 
 static struct gpio_out_group gpio_out_group[] = {
@@ -56,52 +78,218 @@ static struct gpio_desc gpio_led_desc[] = {
     {},
 };
 
+static void btn_set_checked(lv_obj_t *btn, bool checked)
+{
+    if (checked)
+        lv_obj_add_state(btn, LV_STATE_CHECKED);
+    else
+        lv_obj_clear_state(btn, LV_STATE_CHECKED);
+}
+
+/* Set the buttons of a write that didn't fully happen to what their outputs
+ * actually are
+ */
+static void btn_gpio_show(struct gpio_out_group *group,
+  GPIOL1 *const *gpio, const bool *oval, unsigned int n)
+{
+    struct gpio_desc *desc = group->desc;
+    unsigned int i;
+    int y;
+
+    for (i = 0; i < n; i++) {
+        for (y = 0; desc[y].chip_path != NULL; y++) {
+            if (desc[y].gpio == gpio[i])
+                btn_set_checked(desc[y].obj, oval[i]);
+        }
+    }
+}
+
+/* Called on the UI thread once the I/O thread has made the write. On failure
+ * part of it may still have happened, e.g. on one chip of a group and not
+ * the other, the I/O thread hands back what each line was left at.
+ */
+static void btn_gpio_set_done(const struct io_cmd *cmd)
+{
+    if (cmd->ret == 0)
+        return;
+
+    fprintf(stderr, "GPIO write failed: %s\n", strerror(cmd->err));
+    btn_gpio_show(cmd->user_data, cmd->gpio, cmd->oval, cmd->n);
+}
+
+/* A tap toggles the one output. A long press toggles the whole group to the
+ * new state of the pressed button, written together so that the outputs
+ * switch at the same time. Outputs already in that state aren't written.
+ *
+ * The write itself is left to the I/O thread, so a slow GPIO expander never
+ * holds up the UI.
+ */
 static void btn_gpio_set_event_cb(lv_event_t * e)
 {
     lv_obj_t * btn = lv_event_get_target(e);
-    void *gpio = lv_event_get_user_data(e);
+    struct gpio_out_group *group = lv_event_get_user_data(e);
+    struct gpio_desc *desc = group->desc;
+    lv_event_code_t code = lv_event_get_code(e);
+    GPIOL1 *gpio[GPIO_GROUP_MAX];
+    bool oval[GPIO_GROUP_MAX], was[GPIO_GROUP_MAX];
+    bool checked;
+    int y, n = 0;
+
+    if (code == LV_EVENT_LONG_PRESSED) {
+        group->together = true;
+        return;
+    } else if (code == LV_EVENT_PRESS_LOST) {
+        group->together = false;
+        return;
+    } else if (code != LV_EVENT_VALUE_CHANGED) {
+        return;
+    }
+
+    checked = !!(lv_obj_get_state(btn) & LV_STATE_CHECKED);
+    for (y = 0; desc[y].chip_path != NULL && n < GPIO_GROUP_MAX; y++) {
+        /* Disabled while the sequencer is driving it */
+        if (desc[y].gpio == NULL ||
+          lv_obj_has_state(desc[y].obj, LV_STATE_DISABLED))
+            continue;
+        if (!group->together && desc[y].obj != btn)
+            continue;
+
+        /* The tapped button has already toggled, the others show their
+         * output as it is
+         */
+        was[n] = (desc[y].obj == btn) ? !checked :
+          lv_obj_has_state(desc[y].obj, LV_STATE_CHECKED);
+        btn_set_checked(desc[y].obj, checked);
+        gpio[n] = desc[y].gpio;
+        oval[n++] = checked;
+    }
+    group->together = false;
 
-    gpio_oval_set(gpio, !!(lv_obj_get_state(btn) & LV_STATE_CHECKED));
+    if (io_gpio_set(gpio, oval, n, btn_gpio_set_done, group) == -1) {
+        perror("GPIO write");
+        btn_gpio_show(group, gpio, was, n);
+    }
 }
 
-static void led_service(lv_timer_t * timer)
+static void led_set(lv_obj_t *led, int val)
 {
-    lv_obj_t *led = timer->user_data;
-    if (gpio_ival_get(led->user_data)) {
+    if (val) {
         lv_led_on(led);
     } else {
         lv_led_off(led);
     }
 }
 
-static bool gpio_is_init = false;
-void gpio_claim_all_and_set_cb(void)
+#define GPIO_LED_CNT (sizeof(gpio_led_desc) / sizeof(gpio_led_desc[0]) - 1)
+
+/* The level each LED is waiting to settle at, see GPIO_LED_SETTLE_MS */
+static struct {
+    bool pending;
+    int level;
+    uint32_t tick;
+} led_settle[GPIO_LED_CNT];
+static lv_timer_t *led_settle_timer;
+
+/* Only runs while an LED is waiting to settle */
+static void led_settle_cb(lv_timer_t *timer)
 {
-    int x, y;
-    struct gpio_desc *desc;
+    bool waiting = false;
+    unsigned int i;
+
+    for (i = 0; i < GPIO_LED_CNT; i++) {
+        if (!led_settle[i].pending)
+            continue;
+        if (lv_tick_elaps(led_settle[i].tick) < GPIO_LED_SETTLE_MS) {
+            waiting = true;
+            continue;
+        }
+        led_set(gpio_led_desc[i].obj, led_settle[i].level);
+        led_settle[i].pending = false;
+    }
 
-    if (gpio_is_init) return;
+    if (!waiting)
+        lv_timer_pause(timer);
+}
 
-    /* Grab the GPIO and set up callbacks for the out group */
-    for (x = 0; ; x++) {
-        if (gpio_out_group[x].desc == NULL)
+/* Every edge of the inputs is captured by the I/O thread, see cap.h, so this
+ * only runs when a line actually changes and nothing runs while it doesn't.
+ * The channel is the input's index in gpio_led_desc.
+ */
+static void led_edge_cb(const struct cap_edge *edge)
+{
+    led_settle[edge->chan].pending = true;
+    led_settle[edge->chan].level = edge->level;
+    led_settle[edge->chan].tick = lv_tick_get();
+    lv_timer_resume(led_settle_timer);
+
+    la_edge(edge);
+}
+
+/* Claim the lines of a group with one request per chip rather than one per
+ * line. The lines still get their own handles for the buttons to write.
+ */
+static void gpio_claim_group(struct gpio_out_group *group)
+{
+    struct gpio_desc *desc = group->desc;
+    unsigned int lines[GPIO_GROUP_MAX];
+    struct gpio_desc *member[GPIO_GROUP_MAX];
+    GPIOL1_BULK *bulk;
+    int x, y, n, end;
+
+    /* No real error handling, just stop at the first button object that was
+     * not actually allocated ahead of time.
+     */
+    for (end = 0; desc[end].chip_path != NULL; end++) {
+        if (desc[end].obj == NULL)
             break;
+    }
 
-        desc = gpio_out_group[x].desc;
+    for (x = 0; x < end; x++) {
+        if (desc[x].gpio != NULL)
+            continue;
 
-        for (y = 0; ; y++) {
-            /* No real error handling, just bail if the button object was not
-             * actually allocated ahead of time.
-             */
-            if (desc[y].chip_path == NULL || desc[y].obj == NULL)
+        /* Already reported if an earlier line of the same chip failed */
+        for (y = 0; y < x; y++) {
+            if (desc[y].gpio == NULL &&
+              strcmp(desc[y].chip_path, desc[x].chip_path) == 0)
                 break;
+        }
+        if (y < x)
+            continue;
+
+        for (n = 0, y = x; y < end && n < GPIO_GROUP_MAX; y++) {
+            if (desc[y].gpio != NULL ||
+              strcmp(desc[y].chip_path, desc[x].chip_path) != 0)
+                continue;
+            member[n] = &desc[y];
+            lines[n++] = desc[y].line;
+        }
 
-            /* Open and claim the button's associated GPIO */
-            /* TODO: Error check */
-            desc[y].gpio = gpio_alloc(desc[y].chip_path, desc[y].line, 1, 0);
-            lv_obj_add_event_cb(desc[y].obj, btn_gpio_set_event_cb,
-                LV_EVENT_VALUE_CHANGED, desc[y].gpio);
+        /* The buttons of lines that can't be claimed stay disabled */
+        bulk = gpio_bulk_alloc(desc[x].chip_path, lines, n, 1, NULL);
+        if (bulk == NULL) {
+            fprintf(stderr, "GPIO %s, buttons left disabled: %s\n",
+              desc[x].chip_path, strerror(errno));
+            continue;
         }
+
+        for (y = 0; y < n; y++)
+            member[y]->gpio = gpio_bulk_line(bulk, y);
+    }
+}
+
+/* Runs on the I/O thread, so nothing in here may touch LVGL */
+static int gpio_claim_all(void *user_data)
+{
+    struct gpio_desc *desc;
+    int x, y;
+
+    /* Grab the GPIO for the out group */
+    for (x = 0; ; x++) {
+        if (gpio_out_group[x].desc == NULL)
+            break;
+
+        gpio_claim_group(&gpio_out_group[x]);
     }
 
     desc = gpio_led_desc;
@@ -112,16 +300,123 @@ void gpio_claim_all_and_set_cb(void)
         if (desc[y].chip_path == NULL || desc[y].obj == NULL)
             break;
 
-        /* Open and claim the LED's associated GPIO */
-        /* TODO: Error check */
-        desc[y].gpio = gpio_alloc(desc[y].chip_path, desc[y].line, 0, 0);
+        /* Open and claim the LED's associated GPIO, and capture its edges.
+         * No kernel debounce, it would drop the short pulses the logic
+         * analyzer is there to see.
+         */
+        desc[y].gpio = gpio_alloc_events(desc[y].chip_path, desc[y].line,
+          GPIO_EDGE_BOTH, 0);
+        if (desc[y].gpio != NULL)
+            cap_add(desc[y].gpio, y);
+    }
+
+    return 0;
+}
+
+/* The button takes the output back over once its program has ended */
+static void gpio_seq_done(const struct seq_report *report, bool oval,
+  void *user_data)
+{
+    struct gpio_desc *desc = user_data;
+
+    if (report != NULL) {
+        fprintf(stderr, "Sequencer on %s line %d: %llu edges, late avg %llu us "
+          "max %llu us, %llu skipped\n", desc->chip_path, desc->line,
+          (unsigned long long)report->edges,
+          (unsigned long long)(report->late_sum_us / report->edges),
+          (unsigned long long)report->late_max_us,
+          (unsigned long long)report->skipped);
+        btn_set_checked(desc->obj, oval);
+    }
+    lv_obj_clear_state(desc->obj, LV_STATE_DISABLED);
+}
+
+int gpio_seq_add(const char *arg)
+{
+    struct seq_prog prog;
+    unsigned int chip, line;
+    char chip_path[32];
+    struct gpio_desc *desc;
+    int x, y, pos = -1;
+
+    if (sscanf(arg, "%u.%u=%n", &chip, &line, &pos) != 2 || pos == -1 ||
+      seq_parse(arg + pos, &prog) == -1)
+        return -1;
+    snprintf(chip_path, sizeof(chip_path), "/dev/gpiochip%u", chip);
+
+    for (x = 0; gpio_out_group[x].desc != NULL; x++) {
+        desc = gpio_out_group[x].desc;
+        for (y = 0; desc[y].chip_path != NULL; y++) {
+            if (strcmp(desc[y].chip_path, chip_path) != 0 ||
+              desc[y].line != (int)line)
+                continue;
+
+            if (desc[y].seq == NULL)
+                desc[y].seq = malloc(sizeof(prog));
+            if (desc[y].seq == NULL)
+                return -1;
+            *desc[y].seq = prog;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Back on the UI thread once the claim is done. Controls whose line was
+ * claimed are hooked up and enabled, any others stay disabled. Outputs with
+ * a sequencer program start it, and stay disabled until it ends.
+ */
+static void gpio_claim_done(const struct io_cmd *cmd)
+{
+    struct gpio_desc *desc;
+    int x, y;
+
+    for (x = 0; ; x++) {
+        desc = gpio_out_group[x].desc;
+        if (desc == NULL)
+            break;
+
+        for (y = 0; desc[y].chip_path != NULL; y++) {
+            if (desc[y].gpio == NULL)
+                continue;
+            lv_obj_add_event_cb(desc[y].obj, btn_gpio_set_event_cb,
+                LV_EVENT_ALL, &gpio_out_group[x]);
+            if (desc[y].seq != NULL && seq_start(desc[y].gpio, desc[y].seq,
+              gpio_seq_done, &desc[y]) == 0)
+                continue;
+            lv_obj_clear_state(desc[y].obj, LV_STATE_DISABLED);
+        }
+    }
+
+    /* The level when claimed has already been queued up ahead of any edges,
+     * see cap_add()
+     */
+    desc = gpio_led_desc;
+    for (y = 0; desc[y].chip_path != NULL; y++) {
+        if (desc[y].gpio != NULL)
+            lv_obj_clear_state(desc[y].obj, LV_STATE_DISABLED);
+    }
+}
 
-        /* Set up a timer to call the LED servicing routine every 100 ms */
-        lv_obj_set_user_data(desc[y].obj, desc[y].gpio);
-        lv_timer_create(led_service, 100, desc[y].obj);
+static bool gpio_is_init = false;
+void gpio_claim_all_and_set_cb(void)
+{
+    if (gpio_is_init) return;
+
+    if (led_settle_timer == NULL) {
+        led_settle_timer = lv_timer_create(led_settle_cb, GPIO_LED_SETTLE_MS,
+          NULL);
+        lv_timer_pause(led_settle_timer);
     }
+    cap_set_cb(led_edge_cb);
 
-    gpio_is_init = true;
+    /* Opening chips and requesting lines takes long enough to hitch a frame,
+     * so it is left to the I/O thread. Tried again next time if it can't be
+     * posted.
+     */
+    if (io_call(gpio_claim_all, gpio_claim_done, NULL) == 0)
+        gpio_is_init = true;
 }
 
 /* Does not do any atyle setup with the font and relies on defaults and/or
@@ -148,6 +443,8 @@ static lv_obj_t *btn_gpio_set_create(struct gpio_desc *desc, lv_obj_t *cont)
     desc->obj = lv_btn_create(cont);
     lv_obj_add_style(desc->obj, desc->style, LV_PART_MAIN | LV_STATE_DEFAULT);
     lv_obj_add_flag(desc->obj, LV_OBJ_FLAG_CHECKABLE);
+    /* Until the line is claimed, see gpio_claim_done() */
+    lv_obj_add_state(desc->obj, LV_STATE_DISABLED);
 
     label_create_center(desc->obj, desc->label);
 
@@ -163,6 +460,7 @@ static lv_obj_t *btn_gpio_get_create(struct gpio_desc *desc, lv_obj_t *cont)
     lv_led_set_color(desc->obj, lv_color_hex(0xff0000));
     lv_led_off(desc->obj);
     lv_obj_add_style(desc->obj, desc->style, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_add_state(desc->obj, LV_STATE_DISABLED);
 
     return desc->obj;
 }
@@ -2,6 +2,12 @@
 #define __GPIO_H__
 
 void gpio_claim_all_and_set_cb(void);
+
+/* Run a sequencer program on an output once it is claimed. `arg` is
+ * CHIP.LINE=PROGRAM, e.g. 4.4=pulse:500000:500000:10, see seq_parse().
+ * Returns -1 if there is no such output or the program isn't valid.
+ */
+int gpio_seq_add(const char *arg);
 void demo_relay_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width);
 void demo_gpio_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width);
 
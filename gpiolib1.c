@@ -1,32 +1,137 @@
 #include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gpiod.h>
 
 #include "gpiolib1.h"
 
-struct gpiolib {
+/* Events pulled from the kernel per read() */
+#define GPIO_EVENT_BATCH 16
+
+/* Distinct chips that can be open at once */
+#define GPIO_CHIP_MAX 8
+
+/* Opened once per path and shared by every line and request on it */
+struct gpiolib_chip {
+	char *path;
 	struct gpiod_chip *chip;
+	unsigned int refs;
+};
+
+struct gpiolib {
+	struct gpiolib_chip *chip;
 	struct gpiod_line *line;
+	/* Set for lines handed out by gpio_bulk_line() */
+	GPIOL1_BULK *bulk;
+	unsigned int idx;
 	bool oe;
 	bool oval;
 };
 
-void *gpio_alloc(const char *chip_path, unsigned int line, bool oe, bool oval)
+struct gpiolib_bulk {
+	struct gpiolib_chip *chip;
+	struct gpiod_line_bulk lines;
+	/* The uAPI writes every line of a request at once, so the last value set
+	 * on each output is kept to write along with the one that changed.
+	 */
+	int vals[GPIOD_LINE_BULK_MAX_LINES];
+	GPIOL1 gpio[GPIOD_LINE_BULK_MAX_LINES];
+};
+
+static struct gpiolib_chip gpio_chips[GPIO_CHIP_MAX];
+
+static struct gpiolib_chip *gpio_chip_get(const char *chip_path)
+{
+	struct gpiolib_chip *free_slot = NULL;
+	int i;
+
+	for (i = 0; i < GPIO_CHIP_MAX; i++) {
+		if (gpio_chips[i].refs == 0) {
+			if (free_slot == NULL)
+				free_slot = &gpio_chips[i];
+			continue;
+		}
+		if (strcmp(gpio_chips[i].path, chip_path) == 0) {
+			gpio_chips[i].refs++;
+			return &gpio_chips[i];
+		}
+	}
+
+	if (free_slot == NULL) {
+		errno = EMFILE;
+		goto out;
+	}
+
+	free_slot->path = strdup(chip_path);
+	if (free_slot->path == NULL)
+		goto out;
+
+	free_slot->chip = gpiod_chip_open(chip_path);
+	if (free_slot->chip == NULL)
+		goto out_path;
+
+	free_slot->refs = 1;
+	return free_slot;
+
+out_path:
+	free(free_slot->path);
+	free_slot->path = NULL;
+out:
+	return NULL;
+}
+
+static void gpio_chip_put(struct gpiolib_chip *chip)
+{
+	if (--chip->refs > 0)
+		return;
+
+	gpiod_chip_close(chip->chip);
+	free(chip->path);
+	chip->path = NULL;
+	chip->chip = NULL;
+}
+
+/* Look up the line on the shared chip, nothing is requested yet */
+static GPIOL1 *gpio_open(const char *chip_path, unsigned int line)
 {
 	GPIOL1 *gpio = malloc(sizeof(struct gpiolib));
 
 	if (gpio == NULL)
 		goto out;
 
-	gpio->chip = gpiod_chip_open(chip_path);
+	gpio->chip = gpio_chip_get(chip_path);
 	if (gpio->chip == NULL)
 		goto out_free;
 
-	gpio->line = gpiod_chip_get_line(gpio->chip, line);
+	gpio->line = gpiod_chip_get_line(gpio->chip->chip, line);
 	if (gpio->line == NULL)
 		goto out_chip;
 
+	gpio->bulk = NULL;
+	gpio->idx = 0;
+	gpio->oe = false;
+	gpio->oval = false;
+
+	return gpio;
+
+out_chip:
+	gpio_chip_put(gpio->chip);
+out_free:
+	free(gpio);
+out:
+	return NULL;
+}
+
+void *gpio_alloc(const char *chip_path, unsigned int line, bool oe, bool oval)
+{
+	GPIOL1 *gpio = gpio_open(chip_path, line);
+
+	if (gpio == NULL)
+		goto out;
+
 	/* Set up IO based on parameters passed */
 	if (oe) {
 		if (gpiod_line_request_output(gpio->line, "gpiolib1", (int)oval) == -1)
@@ -45,8 +150,46 @@ void *gpio_alloc(const char *chip_path, unsigned int line, bool oe, bool oval)
 	return (void*)gpio;
 
 out_chip:
-	gpiod_chip_close(gpio->chip);
-out_free:
+	gpio_chip_put(gpio->chip);
+	free(gpio);
+out:
+	return NULL;
+}
+
+void *gpio_alloc_events(const char *chip_path, unsigned int line, int edges,
+  unsigned int debounce_us)
+{
+	GPIOL1 *gpio = gpio_open(chip_path, line);
+	int ret, fd;
+
+	if (gpio == NULL)
+		goto out;
+
+	switch (edges) {
+	case GPIO_EDGE_RISING:
+		ret = gpiod_line_request_rising_edge_events(gpio->line, "gpiolib1");
+		break;
+	case GPIO_EDGE_FALLING:
+		ret = gpiod_line_request_falling_edge_events(gpio->line, "gpiolib1");
+		break;
+	default:
+		ret = gpiod_line_request_both_edges_events(gpio->line, "gpiolib1");
+		break;
+	}
+	if (ret == -1)
+		goto out_chip;
+
+	/* So that gpio_event_read() never blocks */
+	fd = gpiod_line_event_get_fd(gpio->line);
+	if (fd == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		goto out_line;
+
+	return (void*)gpio;
+
+out_line:
+	gpiod_line_release(gpio->line);
+out_chip:
+	gpio_chip_put(gpio->chip);
 	free(gpio);
 out:
 	return NULL;
@@ -54,14 +197,25 @@ out:
 
 void gpio_free(GPIOL1 *gpio)
 {
+	/* Released along with the rest of the request by gpio_bulk_free() */
+	if (gpio->bulk != NULL)
+		return;
+
 	gpiod_line_release(gpio->line);
-	gpiod_chip_close(gpio->chip);
+	gpio_chip_put(gpio->chip);
 	free(gpio);
 }
 
 int gpio_direction_set(GPIOL1 *gpio, bool oe, bool oval)
 {
 	int ret;
+
+	/* Would need the whole request reconfigured, not supported */
+	if (gpio->bulk != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	if (oe) {
 		ret = gpiod_line_set_direction_output(gpio->line, oval);
 		gpio->oe = oe;
@@ -86,8 +240,24 @@ bool gpio_direction_get(GPIOL1 *gpio)
  */
 int gpio_oval_set(GPIOL1 *gpio, bool oval)
 {
-	gpio->oval = oval;
-	return gpiod_line_set_value(gpio->line, oval);
+	int ret;
+
+	if (gpio->bulk != NULL) {
+		gpio->bulk->vals[gpio->idx] = oval;
+		ret = gpiod_line_set_value_bulk(&gpio->bulk->lines, gpio->bulk->vals);
+	} else {
+		ret = gpiod_line_set_value(gpio->line, oval);
+	}
+
+	/* Only cache what the line was actually set to */
+	if (ret == -1) {
+		if (gpio->bulk != NULL)
+			gpio->bulk->vals[gpio->idx] = gpio->oval;
+	} else {
+		gpio->oval = oval;
+	}
+
+	return ret;
 }
 
 bool gpio_oval_get(GPIOL1 *gpio)
@@ -101,6 +271,15 @@ bool gpio_oval_get(GPIOL1 *gpio)
  */
 int gpio_ival_get(GPIOL1 *gpio)
 {
+	int vals[GPIOD_LINE_BULK_MAX_LINES];
+
+	/* A single line of a request would read back the request's first line */
+	if (gpio->bulk != NULL) {
+		if (gpiod_line_get_value_bulk(&gpio->bulk->lines, vals) == -1)
+			return -1;
+		return vals[gpio->idx];
+	}
+
 	return gpiod_line_get_value(gpio->line);
 }
 
@@ -109,4 +288,184 @@ int gpio_oval_toggle(GPIOL1 *gpio)
 	return gpio_oval_set(gpio, !(gpio_oval_get(gpio)));
 }
 
+int gpio_group_oval_set(GPIOL1 **gpio, const bool *oval, unsigned int n)
+{
+	bool done[GPIOD_LINE_BULK_MAX_LINES] = { false };
+	GPIOL1_BULK *bulk;
+	unsigned int i, j;
+	bool changed;
+	int err, ret = 0;
+
+	if (n > GPIOD_LINE_BULK_MAX_LINES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (done[i] || gpio[i]->oval == oval[i])
+			continue;
+
+		if (gpio[i]->bulk == NULL) {
+			if (gpio_oval_set(gpio[i], oval[i]) == -1)
+				ret = -1;
+			continue;
+		}
+
+		/* Everything in the group from this request, in one write */
+		bulk = gpio[i]->bulk;
+		changed = false;
+		for (j = i; j < n; j++) {
+			if (gpio[j]->bulk != bulk)
+				continue;
+			done[j] = true;
+			if (gpio[j]->oval == oval[j])
+				continue;
+			bulk->vals[gpio[j]->idx] = oval[j];
+			changed = true;
+		}
+		if (!changed)
+			continue;
+
+		/* On failure, put the group back to what the lines still are */
+		err = gpiod_line_set_value_bulk(&bulk->lines, bulk->vals);
+		if (err == -1)
+			ret = -1;
+		for (j = i; j < n; j++) {
+			if (gpio[j]->bulk != bulk)
+				continue;
+			if (err == -1)
+				bulk->vals[gpio[j]->idx] = gpio[j]->oval;
+			else
+				gpio[j]->oval = oval[j];
+		}
+	}
+
+	return ret;
+}
+
+int gpio_event_fd(GPIOL1 *gpio)
+{
+	return gpiod_line_event_get_fd(gpio->line);
+}
+
+int gpio_event_read(GPIOL1 *gpio, struct gpio_event *ev, unsigned int n)
+{
+	struct gpiod_line_event batch[GPIO_EVENT_BATCH];
+	unsigned int i, cnt = 0;
+	int ret;
+
+	while (cnt < n) {
+		ret = gpiod_line_event_read_multiple(gpio->line, batch,
+		  (n - cnt < GPIO_EVENT_BATCH) ? n - cnt : GPIO_EVENT_BATCH);
+		if (ret <= 0)
+			break;
+
+		for (i = 0; i < (unsigned int)ret; i++, cnt++) {
+			ev[cnt].ts_ns = (batch[i].ts.tv_sec * 1000000000ULL) +
+			  batch[i].ts.tv_nsec;
+			ev[cnt].level = (batch[i].event_type ==
+			  GPIOD_LINE_EVENT_RISING_EDGE);
+		}
+		if (ret < GPIO_EVENT_BATCH)
+			break;
+	}
+
+	return (cnt == 0) ? -1 : (int)cnt;
+}
+
+void *gpio_bulk_alloc(const char *chip_path, const unsigned int *lines,
+  unsigned int n, bool oe, const bool *ovals)
+{
+	GPIOL1_BULK *bulk;
+	unsigned int i;
+	int ret;
+
+	if (n == 0 || n > GPIOD_LINE_BULK_MAX_LINES) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	bulk = calloc(1, sizeof(struct gpiolib_bulk));
+	if (bulk == NULL)
+		goto out;
+
+	bulk->chip = gpio_chip_get(chip_path);
+	if (bulk->chip == NULL)
+		goto out_free;
+
+	/* Looks up every line with one call rather than one per line */
+	if (gpiod_chip_get_lines(bulk->chip->chip, (unsigned int *)lines, n,
+	  &bulk->lines) == -1)
+		goto out_chip;
+
+	for (i = 0; i < n; i++) {
+		bulk->vals[i] = (oe && ovals != NULL) ? ovals[i] : 0;
+		bulk->gpio[i].chip = bulk->chip;
+		bulk->gpio[i].line = gpiod_line_bulk_get_line(&bulk->lines, i);
+		bulk->gpio[i].bulk = bulk;
+		bulk->gpio[i].idx = i;
+		bulk->gpio[i].oe = oe;
+		bulk->gpio[i].oval = bulk->vals[i];
+	}
+
+	/* All of the lines in one request, i.e. one fd and one ioctl */
+	if (oe)
+		ret = gpiod_line_request_bulk_output(&bulk->lines, "gpiolib1",
+		  bulk->vals);
+	else
+		ret = gpiod_line_request_bulk_input(&bulk->lines, "gpiolib1");
+	if (ret == -1)
+		goto out_chip;
+
+	return (void*)bulk;
+
+out_chip:
+	gpio_chip_put(bulk->chip);
+out_free:
+	free(bulk);
+out:
+	return NULL;
+}
+
+void gpio_bulk_free(GPIOL1_BULK *bulk)
+{
+	gpiod_line_release_bulk(&bulk->lines);
+	gpio_chip_put(bulk->chip);
+	free(bulk);
+}
+
+GPIOL1 *gpio_bulk_line(GPIOL1_BULK *bulk, unsigned int i)
+{
+	if (i >= gpiod_line_bulk_num_lines(&bulk->lines))
+		return NULL;
+
+	return &bulk->gpio[i];
+}
+
+int gpio_bulk_ival_get(GPIOL1_BULK *bulk, int *vals)
+{
+	return gpiod_line_get_value_bulk(&bulk->lines, vals);
+}
+
+int gpio_bulk_oval_set(GPIOL1_BULK *bulk, const bool *ovals)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < gpiod_line_bulk_num_lines(&bulk->lines); i++)
+		bulk->vals[i] = ovals[i];
+
+	ret = gpiod_line_set_value_bulk(&bulk->lines, bulk->vals);
+
+	/* Only cache what the lines were actually set to */
+	for (i = 0; i < gpiod_line_bulk_num_lines(&bulk->lines); i++) {
+		if (ret == -1)
+			bulk->vals[i] = bulk->gpio[i].oval;
+		else
+			bulk->gpio[i].oval = ovals[i];
+	}
+
+	return ret;
+}
+
 /* Could also include select() style funcs like original gpiolib*/
@@ -1,11 +1,36 @@
 #ifndef __GPIOLIB1_H__
 #define __GPIOLIB1_H__
+#include <stdbool.h>
 #include <stdint.h>
 
+/* Implemented against libgpiod v1 by gpiolib1.c, or v2 by gpiolib1_v2.c,
+ * whichever is installed at build time.
+ */
+
 typedef struct gpiolib GPIOL1;
+typedef struct gpiolib_bulk GPIOL1_BULK;
+
+/* Each chip is opened once and shared by every line and request on it, it is
+ * closed again along with the last of them. None of this is thread safe.
+ */
+
+/* Edges for gpio_alloc_events() */
+#define GPIO_EDGE_RISING	(1 << 0)
+#define GPIO_EDGE_FALLING	(1 << 1)
+#define GPIO_EDGE_BOTH		(GPIO_EDGE_RISING | GPIO_EDGE_FALLING)
 
 void *gpio_alloc(const char *chip_path, unsigned int line, bool oe, bool oval);
 
+/* Claim the line as an input that has the kernel queue an event for each of
+ * the requested GPIO_EDGE_* edges. gpio_ival_get() still works on it.
+ *
+ * With v2, a non-zero `debounce_us` has the kernel debounce the line, so a
+ * noisy input only reports an edge once it has been stable that long. v1 has
+ * no debounce and ignores it.
+ */
+void *gpio_alloc_events(const char *chip_path, unsigned int line, int edges,
+  unsigned int debounce_us);
+
 void gpio_free(GPIOL1 *gpio);
 
 int gpio_direction_set(GPIOL1 *gpio, bool oe, bool oval);
@@ -28,5 +53,56 @@ int gpio_ival_get(GPIOL1 *gpio);
 	
 int gpio_oval_toggle(GPIOL1 *gpio);
 
+/* Set several output lines at once. Lines whose last set value already
+ * matches are skipped. Lines that are part of the same gpio_bulk_alloc()
+ * request are written together with a single ioctl, so they change at the
+ * same time; any others are written one at a time. Returns -1 if any write
+ * failed.
+ */
+int gpio_group_oval_set(GPIOL1 **gpio, const bool *oval, unsigned int n);
+
+/* Readable while events are pending, for poll() or epoll. Returns -1 if the
+ * line wasn't claimed with gpio_alloc_events().
+ */
+int gpio_event_fd(GPIOL1 *gpio);
+
+struct gpio_event {
+	uint64_t ts_ns;
+	bool level;		/* the line's level after the edge */
+};
+
+/* Read up to `n` pending events without blocking, oldest first. Returns how
+ * many were read, or -1 on error, with errno set to EAGAIN if nothing was
+ * pending. Call again while it returns `n` to drain them all.
+ *
+ * The timestamp is taken by the kernel as the edge is seen, on
+ * CLOCK_MONOTONIC. With v1 that is only the case on kernels since 5.7,
+ * earlier ones use CLOCK_REALTIME.
+ */
+int gpio_event_read(GPIOL1 *gpio, struct gpio_event *ev, unsigned int n);
+
+/* Claim `n` lines of one chip with a single request, so one fd and one
+ * ioctl for all of them. `ovals` may be NULL for all outputs to start low.
+ */
+void *gpio_bulk_alloc(const char *chip_path, const unsigned int *lines,
+  unsigned int n, bool oe, const bool *ovals);
+
+void gpio_bulk_free(GPIOL1_BULK *bulk);
+
+/* Handle for the `i`th line of a request, which works with the single line
+ * calls above other than gpio_direction_set(). It must not be passed to
+ * gpio_free(), it goes away with gpio_bulk_free(). Setting one line leaves
+ * the others as they were. With v1 that means writing every line of the
+ * request, the others with their last value.
+ */
+GPIOL1 *gpio_bulk_line(GPIOL1_BULK *bulk, unsigned int i);
+
+/* Read or write every line of the request in one ioctl, in the order they
+ * were requested. Returns -1 on error.
+ */
+int gpio_bulk_ival_get(GPIOL1_BULK *bulk, int *vals);
+
+int gpio_bulk_oval_set(GPIOL1_BULK *bulk, const bool *ovals);
+
 /* Could also include select() style funcs like original gpiolib*/
 #endif // __GPIOLIB1_H__
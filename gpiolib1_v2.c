@@ -0,0 +1,556 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gpiod.h>
+
+#include "gpiolib1.h"
+
+/* The gpiolib1 interface on top of libgpiod v2, i.e. the GPIO uAPI v2. Every
+ * line, single or not, is part of a gpiod_line_request, which is what the v2
+ * uAPI hands out an fd for.
+ */
+
+/* Events pulled from the kernel per read() */
+#define GPIO_EVENT_BATCH 16
+
+/* Distinct chips that can be open at once */
+#define GPIO_CHIP_MAX 8
+
+/* Most lines in one request, the uAPI's own limit */
+#define GPIO_BULK_MAX 64
+
+/* Opened once per path and shared by every line and request on it */
+struct gpiolib_chip {
+	char *path;
+	struct gpiod_chip *chip;
+	unsigned int refs;
+};
+
+struct gpiolib {
+	struct gpiolib_chip *chip;
+	struct gpiod_line_request *req;
+	unsigned int offset;
+	/* Set for lines handed out by gpio_bulk_line() */
+	GPIOL1_BULK *bulk;
+	/* Only for lines claimed with gpio_alloc_events() */
+	struct gpiod_edge_event_buffer *events;
+	bool oe;
+	bool oval;
+};
+
+struct gpiolib_bulk {
+	struct gpiolib_chip *chip;
+	struct gpiod_line_request *req;
+	unsigned int n;
+	GPIOL1 gpio[GPIO_BULK_MAX];
+};
+
+static struct gpiolib_chip gpio_chips[GPIO_CHIP_MAX];
+
+static struct gpiolib_chip *gpio_chip_get(const char *chip_path)
+{
+	struct gpiolib_chip *free_slot = NULL;
+	int i;
+
+	for (i = 0; i < GPIO_CHIP_MAX; i++) {
+		if (gpio_chips[i].refs == 0) {
+			if (free_slot == NULL)
+				free_slot = &gpio_chips[i];
+			continue;
+		}
+		if (strcmp(gpio_chips[i].path, chip_path) == 0) {
+			gpio_chips[i].refs++;
+			return &gpio_chips[i];
+		}
+	}
+
+	if (free_slot == NULL) {
+		errno = EMFILE;
+		goto out;
+	}
+
+	free_slot->path = strdup(chip_path);
+	if (free_slot->path == NULL)
+		goto out;
+
+	free_slot->chip = gpiod_chip_open(chip_path);
+	if (free_slot->chip == NULL)
+		goto out_path;
+
+	free_slot->refs = 1;
+	return free_slot;
+
+out_path:
+	free(free_slot->path);
+	free_slot->path = NULL;
+out:
+	return NULL;
+}
+
+static void gpio_chip_put(struct gpiolib_chip *chip)
+{
+	if (--chip->refs > 0)
+		return;
+
+	gpiod_chip_close(chip->chip);
+	free(chip->path);
+	chip->path = NULL;
+	chip->chip = NULL;
+}
+
+/* Input, or output starting at `oval` */
+static int gpio_settings_dir(struct gpiod_line_settings *settings, bool oe,
+  bool oval)
+{
+	if (!oe)
+		return gpiod_line_settings_set_direction(settings,
+		  GPIOD_LINE_DIRECTION_INPUT);
+
+	if (gpiod_line_settings_set_direction(settings,
+	  GPIOD_LINE_DIRECTION_OUTPUT) == -1)
+		return -1;
+
+	return gpiod_line_settings_set_output_value(settings,
+	  oval ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE);
+}
+
+/* Request `n` lines of the chip, the first `n_settings` of them with their
+ * own settings and the rest with the last of those.
+ */
+static struct gpiod_line_request *gpio_request(struct gpiolib_chip *chip,
+  const unsigned int *lines, unsigned int n,
+  struct gpiod_line_settings **settings, unsigned int n_settings)
+{
+	struct gpiod_request_config *req_cfg;
+	struct gpiod_line_config *line_cfg;
+	struct gpiod_line_request *req = NULL;
+	unsigned int i;
+
+	req_cfg = gpiod_request_config_new();
+	if (req_cfg == NULL)
+		goto out;
+	gpiod_request_config_set_consumer(req_cfg, "gpiolib1");
+
+	line_cfg = gpiod_line_config_new();
+	if (line_cfg == NULL)
+		goto out_req_cfg;
+
+	for (i = 0; i < n; i++) {
+		if (gpiod_line_config_add_line_settings(line_cfg, &lines[i], 1,
+		  settings[(i < n_settings) ? i : n_settings - 1]) == -1)
+			goto out_line_cfg;
+	}
+
+	req = gpiod_chip_request_lines(chip->chip, req_cfg, line_cfg);
+
+out_line_cfg:
+	gpiod_line_config_free(line_cfg);
+out_req_cfg:
+	gpiod_request_config_free(req_cfg);
+out:
+	return req;
+}
+
+/* Claim a single line as a request of its own */
+static GPIOL1 *gpio_open(const char *chip_path, unsigned int line,
+  struct gpiod_line_settings *settings)
+{
+	GPIOL1 *gpio = calloc(1, sizeof(struct gpiolib));
+
+	if (gpio == NULL)
+		goto out;
+
+	gpio->chip = gpio_chip_get(chip_path);
+	if (gpio->chip == NULL)
+		goto out_free;
+
+	gpio->req = gpio_request(gpio->chip, &line, 1, &settings, 1);
+	if (gpio->req == NULL)
+		goto out_chip;
+	gpio->offset = line;
+
+	return gpio;
+
+out_chip:
+	gpio_chip_put(gpio->chip);
+out_free:
+	free(gpio);
+out:
+	return NULL;
+}
+
+void *gpio_alloc(const char *chip_path, unsigned int line, bool oe, bool oval)
+{
+	struct gpiod_line_settings *settings;
+	GPIOL1 *gpio = NULL;
+
+	settings = gpiod_line_settings_new();
+	if (settings == NULL)
+		goto out;
+
+	/* Set up IO based on parameters passed */
+	if (gpio_settings_dir(settings, oe, oval) == -1)
+		goto out_settings;
+
+	gpio = gpio_open(chip_path, line, settings);
+	if (gpio == NULL)
+		goto out_settings;
+
+	gpio->oe = oe;
+	gpio->oval = oe ? oval : false;
+
+out_settings:
+	gpiod_line_settings_free(settings);
+out:
+	return (void*)gpio;
+}
+
+void *gpio_alloc_events(const char *chip_path, unsigned int line, int edges,
+  unsigned int debounce_us)
+{
+	struct gpiod_line_settings *settings;
+	enum gpiod_line_edge edge;
+	GPIOL1 *gpio = NULL;
+	int fd;
+
+	switch (edges) {
+	case GPIO_EDGE_RISING:
+		edge = GPIOD_LINE_EDGE_RISING;
+		break;
+	case GPIO_EDGE_FALLING:
+		edge = GPIOD_LINE_EDGE_FALLING;
+		break;
+	default:
+		edge = GPIOD_LINE_EDGE_BOTH;
+		break;
+	}
+
+	settings = gpiod_line_settings_new();
+	if (settings == NULL)
+		goto out;
+
+	/* Timestamps on the same clock as everything else in the demo */
+	if (gpiod_line_settings_set_direction(settings,
+	  GPIOD_LINE_DIRECTION_INPUT) == -1 ||
+	  gpiod_line_settings_set_edge_detection(settings, edge) == -1 ||
+	  gpiod_line_settings_set_event_clock(settings,
+	  GPIOD_LINE_CLOCK_MONOTONIC) == -1)
+		goto out_settings;
+	gpiod_line_settings_set_debounce_period_us(settings, debounce_us);
+
+	gpio = gpio_open(chip_path, line, settings);
+	if (gpio == NULL)
+		goto out_settings;
+
+	gpio->events = gpiod_edge_event_buffer_new(GPIO_EVENT_BATCH);
+	if (gpio->events == NULL)
+		goto out_gpio;
+
+	/* So that gpio_event_read() never blocks */
+	fd = gpiod_line_request_get_fd(gpio->req);
+	if (fd == -1 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		goto out_gpio;
+
+	goto out_settings;
+
+out_gpio:
+	gpio_free(gpio);
+	gpio = NULL;
+out_settings:
+	gpiod_line_settings_free(settings);
+out:
+	return (void*)gpio;
+}
+
+void gpio_free(GPIOL1 *gpio)
+{
+	/* Released along with the rest of the request by gpio_bulk_free() */
+	if (gpio->bulk != NULL)
+		return;
+
+	if (gpio->events != NULL)
+		gpiod_edge_event_buffer_free(gpio->events);
+	gpiod_line_request_release(gpio->req);
+	gpio_chip_put(gpio->chip);
+	free(gpio);
+}
+
+int gpio_direction_set(GPIOL1 *gpio, bool oe, bool oval)
+{
+	struct gpiod_line_settings *settings;
+	struct gpiod_line_config *line_cfg;
+	int ret = -1;
+
+	/* Would need the whole request reconfigured, not supported */
+	if (gpio->bulk != NULL) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	settings = gpiod_line_settings_new();
+	if (settings == NULL)
+		goto out;
+
+	line_cfg = gpiod_line_config_new();
+	if (line_cfg == NULL)
+		goto out_settings;
+
+	if (gpio_settings_dir(settings, oe, oval) == -1 ||
+	  gpiod_line_config_add_line_settings(line_cfg, &gpio->offset, 1,
+	  settings) == -1)
+		goto out_line_cfg;
+
+	ret = gpiod_line_request_reconfigure_lines(gpio->req, line_cfg);
+	gpio->oe = oe;
+	gpio->oval = oe ? oval : false;
+
+out_line_cfg:
+	gpiod_line_config_free(line_cfg);
+out_settings:
+	gpiod_line_settings_free(settings);
+out:
+	return ret;
+}
+
+bool gpio_direction_get(GPIOL1 *gpio)
+{
+	return gpio->oe;
+}
+
+/* Returns -1 with errno EPERM if the line is requested as an input, the v2
+ * uAPI only sets values on outputs. The direction isn't changed for it.
+ */
+int gpio_oval_set(GPIOL1 *gpio, bool oval)
+{
+	/* v2 writes only the lines asked for, even out of a bigger request */
+	if (gpiod_line_request_set_value(gpio->req, gpio->offset,
+	  oval ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE) == -1)
+		return -1;
+
+	/* Only cache what the line was actually set to */
+	gpio->oval = oval;
+	return 0;
+}
+
+bool gpio_oval_get(GPIOL1 *gpio)
+{
+	return gpio->oval;
+}
+
+/* Returns -1 on error. Under v2 this works whichever way the line is
+ * requested, for an output it is the level the line reads back.
+ */
+int gpio_ival_get(GPIOL1 *gpio)
+{
+	enum gpiod_line_value val;
+
+	val = gpiod_line_request_get_value(gpio->req, gpio->offset);
+	if (val == GPIOD_LINE_VALUE_ERROR)
+		return -1;
+
+	return (val == GPIOD_LINE_VALUE_ACTIVE);
+}
+
+int gpio_oval_toggle(GPIOL1 *gpio)
+{
+	return gpio_oval_set(gpio, !(gpio_oval_get(gpio)));
+}
+
+int gpio_group_oval_set(GPIOL1 **gpio, const bool *oval, unsigned int n)
+{
+	enum gpiod_line_value vals[GPIO_BULK_MAX];
+	unsigned int offsets[GPIO_BULK_MAX], idx[GPIO_BULK_MAX];
+	bool done[GPIO_BULK_MAX] = { false };
+	GPIOL1_BULK *bulk;
+	unsigned int i, j, cnt;
+	int ret = 0;
+
+	if (n > GPIO_BULK_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (done[i] || gpio[i]->oval == oval[i])
+			continue;
+
+		if (gpio[i]->bulk == NULL) {
+			if (gpio_oval_set(gpio[i], oval[i]) == -1)
+				ret = -1;
+			continue;
+		}
+
+		/* Only what changed out of this request, in one write */
+		bulk = gpio[i]->bulk;
+		cnt = 0;
+		for (j = i; j < n; j++) {
+			if (gpio[j]->bulk != bulk)
+				continue;
+			done[j] = true;
+			if (gpio[j]->oval == oval[j])
+				continue;
+			idx[cnt] = j;
+			offsets[cnt] = gpio[j]->offset;
+			vals[cnt++] = oval[j] ? GPIOD_LINE_VALUE_ACTIVE :
+			  GPIOD_LINE_VALUE_INACTIVE;
+		}
+		if (gpiod_line_request_set_values_subset(bulk->req, cnt, offsets,
+		  vals) == -1) {
+			ret = -1;
+			continue;
+		}
+
+		/* Only cache what the lines were actually set to */
+		for (j = 0; j < cnt; j++)
+			gpio[idx[j]]->oval = oval[idx[j]];
+	}
+
+	return ret;
+}
+
+int gpio_event_fd(GPIOL1 *gpio)
+{
+	if (gpio->events == NULL)
+		return -1;
+
+	return gpiod_line_request_get_fd(gpio->req);
+}
+
+int gpio_event_read(GPIOL1 *gpio, struct gpio_event *ev, unsigned int n)
+{
+	struct gpiod_edge_event *e;
+	unsigned int i, cnt = 0;
+	int ret;
+
+	if (gpio->events == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (cnt < n) {
+		ret = gpiod_line_request_read_edge_events(gpio->req, gpio->events,
+		  (n - cnt < GPIO_EVENT_BATCH) ? n - cnt : GPIO_EVENT_BATCH);
+		if (ret <= 0)
+			break;
+
+		for (i = 0; i < (unsigned int)ret; i++, cnt++) {
+			e = gpiod_edge_event_buffer_get_event(gpio->events, i);
+			ev[cnt].ts_ns = gpiod_edge_event_get_timestamp_ns(e);
+			ev[cnt].level = (gpiod_edge_event_get_event_type(e) ==
+			  GPIOD_EDGE_EVENT_RISING_EDGE);
+		}
+		if (ret < GPIO_EVENT_BATCH)
+			break;
+	}
+
+	return (cnt == 0) ? -1 : (int)cnt;
+}
+
+void *gpio_bulk_alloc(const char *chip_path, const unsigned int *lines,
+  unsigned int n, bool oe, const bool *ovals)
+{
+	struct gpiod_line_settings *settings[GPIO_BULK_MAX];
+	GPIOL1_BULK *bulk;
+	unsigned int i, n_settings = 0;
+
+	if (n == 0 || n > GPIO_BULK_MAX) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	bulk = calloc(1, sizeof(struct gpiolib_bulk));
+	if (bulk == NULL)
+		goto out;
+
+	bulk->chip = gpio_chip_get(chip_path);
+	if (bulk->chip == NULL)
+		goto out_free;
+
+	/* Outputs each start at their own value, inputs all share one */
+	for (i = 0; i < ((oe && ovals != NULL) ? n : 1); i++) {
+		settings[i] = gpiod_line_settings_new();
+		if (settings[i] == NULL)
+			goto out_settings;
+		n_settings++;
+		if (gpio_settings_dir(settings[i], oe,
+		  (oe && ovals != NULL) ? ovals[i] : false) == -1)
+			goto out_settings;
+	}
+
+	/* All of the lines in one request, i.e. one fd and one ioctl */
+	bulk->req = gpio_request(bulk->chip, lines, n, settings, n_settings);
+	if (bulk->req == NULL)
+		goto out_settings;
+
+	bulk->n = n;
+	for (i = 0; i < n; i++) {
+		bulk->gpio[i].chip = bulk->chip;
+		bulk->gpio[i].req = bulk->req;
+		bulk->gpio[i].offset = lines[i];
+		bulk->gpio[i].bulk = bulk;
+		bulk->gpio[i].oe = oe;
+		bulk->gpio[i].oval = (oe && ovals != NULL) ? ovals[i] : false;
+	}
+
+	for (i = 0; i < n_settings; i++)
+		gpiod_line_settings_free(settings[i]);
+
+	return (void*)bulk;
+
+out_settings:
+	for (i = 0; i < n_settings; i++)
+		gpiod_line_settings_free(settings[i]);
+	gpio_chip_put(bulk->chip);
+out_free:
+	free(bulk);
+out:
+	return NULL;
+}
+
+void gpio_bulk_free(GPIOL1_BULK *bulk)
+{
+	gpiod_line_request_release(bulk->req);
+	gpio_chip_put(bulk->chip);
+	free(bulk);
+}
+
+GPIOL1 *gpio_bulk_line(GPIOL1_BULK *bulk, unsigned int i)
+{
+	if (i >= bulk->n)
+		return NULL;
+
+	return &bulk->gpio[i];
+}
+
+int gpio_bulk_ival_get(GPIOL1_BULK *bulk, int *vals)
+{
+	enum gpiod_line_value v[GPIO_BULK_MAX];
+	unsigned int i;
+
+	if (gpiod_line_request_get_values(bulk->req, v) == -1)
+		return -1;
+
+	for (i = 0; i < bulk->n; i++)
+		vals[i] = (v[i] == GPIOD_LINE_VALUE_ACTIVE);
+
+	return 0;
+}
+
+int gpio_bulk_oval_set(GPIOL1_BULK *bulk, const bool *ovals)
+{
+	enum gpiod_line_value v[GPIO_BULK_MAX];
+	unsigned int i;
+
+	for (i = 0; i < bulk->n; i++)
+		v[i] = ovals[i] ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE;
+
+	if (gpiod_line_request_set_values(bulk->req, v) == -1)
+		return -1;
+
+	/* Only cache what the lines were actually set to */
+	for (i = 0; i < bulk->n; i++)
+		bulk->gpio[i].oval = ovals[i];
+	return 0;
+}
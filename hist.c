@@ -0,0 +1,207 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "hist.h"
+
+#define HIST_BIN_NS (HIST_BIN_MS * 1000000ULL)
+
+/* Each level's bins are 1 << HIST_SHIFT times as long as the one below */
+#define HIST_SHIFT 2
+
+/* Bins in the bottom level, a little over 24 hours of them. Every level
+ * covers the same time, so this must divide down evenly to the top one.
+ */
+#define HIST_SLOTS (53U << (HIST_SHIFT * (HIST_LEVELS - 1)))
+
+struct hist_bin {
+    int16_t min[HIST_CHAN_MAX];
+    int16_t max[HIST_CHAN_MAX];
+};
+
+static struct hist_bin *hist_level[HIST_LEVELS];
+
+/* Bottom level bins of the first sample and of the newest */
+static uint64_t hist_first;
+static uint64_t hist_head;
+static bool hist_started;
+
+/* Added to from the acquisition thread and read back from the UI thread */
+static pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hist_slots(unsigned int k)
+{
+    return HIST_SLOTS >> (k * HIST_SHIFT);
+}
+
+/* Bin `b` of level `k`, counted from 0 on CLOCK_MONOTONIC */
+static struct hist_bin *hist_bin(unsigned int k, uint64_t b)
+{
+    return &hist_level[k][b % hist_slots(k)];
+}
+
+static void hist_clear(struct hist_bin *bin)
+{
+    unsigned int i;
+
+    for (i = 0; i < HIST_CHAN_MAX; i++) {
+        bin->min[i] = HIST_EMPTY_MIN;
+        bin->max[i] = HIST_EMPTY_MAX;
+    }
+}
+
+/* Move the head on to `b`, clearing out the bins it passes on every level */
+static void hist_advance(uint64_t b)
+{
+    uint64_t old, new, j;
+    unsigned int k;
+
+    for (k = 0; k < HIST_LEVELS; k++) {
+        old = hist_head >> (k * HIST_SHIFT);
+        new = b >> (k * HIST_SHIFT);
+        j = old + 1;
+        if (new - old > hist_slots(k))
+            j = new - hist_slots(k) + 1;
+        for (; j <= new; j++)
+            hist_clear(hist_bin(k, j));
+    }
+
+    hist_head = b;
+}
+
+int hist_init(void)
+{
+    unsigned int k;
+
+    /* Only ever written a bin at a time as time passes, so the pages are
+     * touched gradually over the first day rather than all at start.
+     */
+    for (k = 0; k < HIST_LEVELS; k++) {
+        hist_level[k] = calloc(hist_slots(k), sizeof(struct hist_bin));
+        if (hist_level[k] == NULL)
+            goto out;
+    }
+
+    return 0;
+
+out:
+    while (k-- > 0) {
+        free(hist_level[k]);
+        hist_level[k] = NULL;
+    }
+    return -1;
+}
+
+void hist_add(unsigned int chan, uint64_t ts_ns, int32_t value)
+{
+    struct hist_bin *bin;
+    uint64_t b = ts_ns / HIST_BIN_NS;
+    unsigned int k;
+    int16_t v;
+
+    if (hist_level[0] == NULL || chan >= HIST_CHAN_MAX)
+        return;
+
+    pthread_mutex_lock(&hist_lock);
+    if (!hist_started) {
+        for (k = 0; k < HIST_LEVELS; k++)
+            hist_clear(hist_bin(k, b >> (k * HIST_SHIFT)));
+        hist_first = hist_head = b;
+        hist_started = true;
+    } else if (b > hist_head) {
+        hist_advance(b);
+    } else if (b < hist_first || hist_head - b >= HIST_SLOTS) {
+        pthread_mutex_unlock(&hist_lock);
+        return;
+    }
+
+    /* Keep clear of the empty markers */
+    if (value >= HIST_EMPTY_MIN)
+        v = HIST_EMPTY_MIN - 1;
+    else if (value <= HIST_EMPTY_MAX)
+        v = HIST_EMPTY_MAX + 1;
+    else
+        v = value;
+
+    for (k = 0; k < HIST_LEVELS; k++) {
+        bin = hist_bin(k, b >> (k * HIST_SHIFT));
+        if (v < bin->min[chan])
+            bin->min[chan] = v;
+        if (v > bin->max[chan])
+            bin->max[chan] = v;
+    }
+    pthread_mutex_unlock(&hist_lock);
+}
+
+/* Min and max of the bottom level bins `lo` to `hi`, read from level `k` */
+static void hist_read_col(unsigned int k, uint64_t lo, uint64_t hi,
+  struct hist_bin *out)
+{
+    const struct hist_bin *bin;
+    uint64_t j, oldest;
+    unsigned int i;
+
+    hist_clear(out);
+    if (!hist_started)
+        return;
+
+    if (lo < hist_first)
+        lo = hist_first;
+    if (hi > hist_head)
+        hi = hist_head;
+    if (lo > hi)
+        return;
+
+    lo >>= k * HIST_SHIFT;
+    hi >>= k * HIST_SHIFT;
+    oldest = (hist_head >> (k * HIST_SHIFT)) - hist_slots(k) + 1;
+    if (hist_head >> (k * HIST_SHIFT) >= hist_slots(k) && lo < oldest)
+        lo = oldest;
+
+    for (j = lo; j <= hi; j++) {
+        bin = hist_bin(k, j);
+        for (i = 0; i < HIST_CHAN_MAX; i++) {
+            if (bin->min[i] < out->min[i])
+                out->min[i] = bin->min[i];
+            if (bin->max[i] > out->max[i])
+                out->max[i] = bin->max[i];
+        }
+    }
+}
+
+void hist_read(uint64_t end_ns, uint64_t col_ns, unsigned int cols,
+  int16_t *min[HIST_CHAN_MAX], int16_t *max[HIST_CHAN_MAX])
+{
+    struct hist_bin col;
+    uint64_t col_bins = col_ns / HIST_BIN_NS;
+    uint64_t start, lo, hi;
+    unsigned int c, i, k = 0;
+
+    if (hist_level[0] == NULL)
+        col_ns = 0;
+
+    /* The coarsest level with bins no longer than a column, so that every
+     * column reads at most a handful of them.
+     */
+    while (k + 1 < HIST_LEVELS &&
+      (1ULL << ((k + 1) * HIST_SHIFT)) <= col_bins)
+        k++;
+
+    pthread_mutex_lock(&hist_lock);
+    for (c = 0; c < cols; c++) {
+        hist_clear(&col);
+        start = (cols - c) * col_ns;
+        if (col_ns > 0 && start <= end_ns) {
+            start = end_ns - start;
+            lo = start / HIST_BIN_NS;
+            hi = (start + col_ns - 1) / HIST_BIN_NS;
+            hist_read_col(k, lo, hi, &col);
+        }
+
+        for (i = 0; i < HIST_CHAN_MAX; i++) {
+            min[i][c] = col.min[i];
+            max[i][c] = col.max[i];
+        }
+    }
+    pthread_mutex_unlock(&hist_lock);
+}
@@ -0,0 +1,38 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+#include <stdint.h>
+
+/* History of the ADC channels, a little over 24 hours of it in a ring that is
+ * allocated once at start. Samples are kept as the min and max of each
+ * HIST_BIN_MS bin, and above that as a pyramid of coarser bins, each level
+ * 4 times as long as the one below, all kept up to date as samples come in.
+ * Reading back any span as min/max columns costs about the same per column
+ * whether it covers 10 s or the whole day.
+ */
+#define HIST_CHAN_MAX 4
+
+#define HIST_BIN_MS 100
+#define HIST_LEVELS 8
+
+/* Values are kept in 16 bits, a column with no samples reads back with min
+ * HIST_EMPTY_MIN and max HIST_EMPTY_MAX, i.e. min > max.
+ */
+#define HIST_EMPTY_MIN INT16_MAX
+#define HIST_EMPTY_MAX INT16_MIN
+
+/* Allocate the ring. Returns -1 on error, history is silently not kept. */
+int hist_init(void);
+
+/* Add a sample of `chan`, taken at `ts_ns` on CLOCK_MONOTONIC. Samples can
+ * come in a little out of order, anything older than the ring is dropped.
+ * This and hist_read() are safe from any thread, they share a lock.
+ */
+void hist_add(unsigned int chan, uint64_t ts_ns, int32_t value);
+
+/* Read back `cols` columns of `col_ns` each, the last ending at `end_ns`, as
+ * the min and max of each channel over each.
+ */
+void hist_read(uint64_t end_ns, uint64_t col_ns, unsigned int cols,
+  int16_t *min[HIST_CHAN_MAX], int16_t *max[HIST_CHAN_MAX]);
+
+#endif // __HIST_H__
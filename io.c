@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "cap.h"
+#include "io.h"
+#include "loop.h"
+#include "ring.h"
+#include "seq.h"
+#include "stats.h"
+
+/* Far more than a finger can queue up, a full ring means the thread is stuck */
+#define IO_RING_SLOTS 16
+
+/* Below the kernel's threaded IRQ handlers at 50, so a GPIO expander's
+ * interrupt can still preempt the thread
+ */
+#define IO_RT_PRIO 40
+
+/* UI thread to I/O thread, and the completions back */
+static struct ring io_cmd_ring;
+static struct ring io_done_ring;
+
+/* The I/O thread sleeps on the first, the main loop watches the second */
+static int io_cmd_fd = -1;
+static int io_done_fd = -1;
+
+/* Only touched by the I/O thread, set when io_done_fd needs a write */
+static bool io_pushed;
+
+static int io_post(const struct io_cmd *cmd)
+{
+    if (!ring_push(&io_cmd_ring, cmd)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    loop_efd_signal(io_cmd_fd);
+
+    return 0;
+}
+
+int io_gpio_set(GPIOL1 **gpio, const bool *oval, unsigned int n,
+  void (*done)(const struct io_cmd *cmd), void *user_data)
+{
+    uint64_t start = stats_now_us();
+    struct io_cmd cmd = {
+        .n = n,
+        .posted_us = start,
+        .done = done,
+        .user_data = user_data,
+    };
+
+    if (n > IO_GPIO_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(cmd.gpio, gpio, n * sizeof(*gpio));
+    memcpy(cmd.oval, oval, n * sizeof(*oval));
+
+    if (io_post(&cmd) == -1)
+        return -1;
+
+    stats_record(STAT_GPIO_POST_US, stats_now_us() - start);
+    return 0;
+}
+
+int io_call(int (*fn)(void *user_data),
+  void (*done)(const struct io_cmd *cmd), void *user_data)
+{
+    struct io_cmd cmd = {
+        .fn = fn,
+        .posted_us = stats_now_us(),
+        .done = done,
+        .user_data = user_data,
+    };
+
+    return io_post(&cmd);
+}
+
+int io_done(void (*done)(const struct io_cmd *cmd), int ret, void *user_data)
+{
+    struct io_cmd cmd = {
+        .posted_us = stats_now_us(),
+        .ret = ret,
+        .done = done,
+        .user_data = user_data,
+    };
+
+    if (!ring_push(&io_done_ring, &cmd)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    io_pushed = true;
+
+    return 0;
+}
+
+static void *io_thread(void *arg)
+{
+    struct pollfd pfd[3] = {
+        { .fd = io_cmd_fd, .events = POLLIN },
+        /* poll() skips these if they couldn't be set up */
+        { .fd = seq_init(), .events = POLLIN },
+        { .fd = cap_fd(), .events = POLLIN },
+    };
+    struct io_cmd cmd;
+    uint64_t cnt;
+    unsigned int i;
+
+    while (1) {
+        if (poll(pfd, 3, -1) <= 0)
+            continue;
+
+        /* Edges first, they are the ones with a deadline, then captured
+         * ones before the kernel's queue of them can fill up
+         */
+        if (pfd[1].revents & POLLIN)
+            seq_run();
+        if (pfd[2].revents & POLLIN)
+            cap_run();
+
+        /* The eventfd counts posts until they are taken */
+        if ((pfd[0].revents & POLLIN) &&
+          read(io_cmd_fd, &cnt, sizeof(cnt)) == sizeof(cnt)) {
+            while (ring_pop(&io_cmd_ring, &cmd)) {
+                errno = 0;
+                if (cmd.fn != NULL) {
+                    cmd.ret = cmd.fn(cmd.user_data);
+                } else {
+                    cmd.ret = gpio_group_oval_set(cmd.gpio, cmd.oval, cmd.n);
+                    stats_record(STAT_GPIO_US, stats_now_us() - cmd.posted_us);
+                }
+                cmd.err = (cmd.ret == -1) ? errno : 0;
+
+                /* Only what was written is cached, see gpio_oval_get() */
+                for (i = 0; i < cmd.n; i++)
+                    cmd.oval[i] = gpio_oval_get(cmd.gpio[i]);
+
+                /* If the UI has fallen this far behind, it is lost */
+                if (cmd.done != NULL && ring_push(&io_done_ring, &cmd))
+                    io_pushed = true;
+            }
+        }
+
+        if (io_pushed) {
+            io_pushed = false;
+            loop_efd_signal(io_done_fd);
+        }
+    }
+
+    return NULL;
+}
+
+/* Try for real-time priority, falling back to a normal thread when it isn't
+ * allowed, e.g. when not run as root.
+ */
+static int io_thread_create(pthread_t *thread)
+{
+    struct sched_param param = { .sched_priority = IO_RT_PRIO };
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(thread, &attr, io_thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (ret == EPERM)
+        ret = pthread_create(thread, NULL, io_thread, NULL);
+
+    return ret;
+}
+
+/* Hand completions back, once per main loop wakeup */
+static void io_drain(int fd, uint32_t events, void *user_data)
+{
+    struct io_cmd cmd;
+
+    loop_efd_drain(fd);
+
+    while (ring_pop(&io_done_ring, &cmd))
+        cmd.done(&cmd);
+}
+
+int io_start(void)
+{
+    pthread_t thread;
+
+    if (ring_init(&io_cmd_ring, IO_RING_SLOTS, sizeof(struct io_cmd)) == -1)
+        return -1;
+
+    if (ring_init(&io_done_ring, IO_RING_SLOTS, sizeof(struct io_cmd)) == -1)
+        goto out_cmd_ring;
+
+    io_cmd_fd = eventfd(0, EFD_CLOEXEC);
+    if (io_cmd_fd == -1)
+        goto out_done_ring;
+
+    io_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (io_done_fd == -1)
+        goto out_cmd_fd;
+
+    if (loop_add_fd(io_done_fd, EPOLLIN, io_drain, NULL) == -1)
+        goto out_done_fd;
+
+    if (io_thread_create(&thread) != 0)
+        goto out_loop;
+    pthread_setname_np(thread, "io");
+    pthread_detach(thread);
+
+    return 0;
+
+out_loop:
+    loop_del_fd(io_done_fd);
+out_done_fd:
+    close(io_done_fd);
+    io_done_fd = -1;
+out_cmd_fd:
+    close(io_cmd_fd);
+    io_cmd_fd = -1;
+out_done_ring:
+    ring_free(&io_done_ring);
+out_cmd_ring:
+    ring_free(&io_cmd_ring);
+    return -1;
+}
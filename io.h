@@ -0,0 +1,64 @@
+#ifndef __IO_H__
+#define __IO_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpiolib1.h"
+
+/* The I/O thread carries out GPIO work on behalf of the UI, i.e. claiming
+ * lines, writing outputs, running the sequencer, see seq.h, and capturing
+ * input edges, see cap.h. Work is posted to a bounded lock-free ring and the
+ * UI carries on, so a slow GPIO expander can never stall touch handling or
+ * rendering. Completions come back through a second ring that the UI thread
+ * drains from the main loop.
+ *
+ * The thread runs SCHED_FIFO where it is allowed to, so that neither
+ * sequencer edges nor captured ones are held up by rendering.
+ *
+ * gpiolib1 isn't thread safe, so once the I/O thread is started everything
+ * that calls into it must go through the I/O thread.
+ */
+
+/* Most lines in one write */
+#define IO_GPIO_MAX 8
+
+struct io_cmd {
+    /* Set for io_call(), otherwise the outputs below are written */
+    int (*fn)(void *user_data);
+    GPIOL1 *gpio[IO_GPIO_MAX];
+    /* Back in `done`, what each line was actually left at */
+    bool oval[IO_GPIO_MAX];
+    unsigned int n;
+    uint64_t posted_us;     /* stats_now_us() when it was posted */
+    int ret;                /* from gpio_group_oval_set() or `fn` */
+    int err;                /* errno if ret is -1 */
+    void (*done)(const struct io_cmd *cmd);
+    void *user_data;
+};
+
+/* Post a write of `n` outputs, done as one gpio_group_oval_set(). Never
+ * blocks. `done`, if not NULL, is called on the UI thread once the write has
+ * been made, with `ret` and `err` filled in. Returns -1 if the queue is full,
+ * `done` is not called then.
+ */
+int io_gpio_set(GPIOL1 **gpio, const bool *oval, unsigned int n,
+  void (*done)(const struct io_cmd *cmd), void *user_data);
+
+/* Post a call of `fn` on the I/O thread, e.g. to claim lines. Otherwise the
+ * same as io_gpio_set().
+ */
+int io_call(int (*fn)(void *user_data),
+  void (*done)(const struct io_cmd *cmd), void *user_data);
+
+/* For work running on the I/O thread, e.g. the sequencer. Has `done` called
+ * on the UI thread as if an io_call() had just returned `ret`. Returns -1 if
+ * the completion was lost.
+ */
+int io_done(void (*done)(const struct io_cmd *cmd), int ret, void *user_data);
+
+/* Start the I/O thread and register its completion fd with the main loop.
+ * Returns -1 on error.
+ */
+int io_start(void);
+
+#endif // __IO_H__
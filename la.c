@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <time.h>
+#include "lvgl/lvgl.h"
+
+#include "cap.h"
+#include "la.h"
+#include "stats.h"
+
+/* Time across the width of the trace, and how often it scrolls */
+#define LA_WINDOW_MS 2000
+#define LA_REFRESH_MS 40
+
+/* Columns of history kept per channel, at least as many as the trace is
+ * wide. Must be a power of 2.
+ */
+#define LA_COLS 512
+
+#define LA_PAD 4
+
+/* What a channel did during one column's worth of time. Both is an input
+ * toggling faster than a pixel can show, which is drawn as a solid band.
+ */
+#define LA_LOW (1 << 0)
+#define LA_HIGH (1 << 1)
+#define LA_BOTH (LA_LOW | LA_HIGH)
+
+/* Edges are decimated as they come in, into one of the above per column, so
+ * drawing costs the same however fast the inputs are toggling: at most a
+ * line or band for every change between columns.
+ */
+struct la_chan {
+    const char *label;
+    lv_palette_t color;
+    uint8_t col[LA_COLS];
+    uint64_t cur;           /* newest column filled in */
+    uint8_t level;          /* LA_LOW or LA_HIGH, 0 before the first edge */
+};
+
+/* In the same order as gpio_led_desc, their channel numbers for cap.h */
+static struct la_chan la_chan[] = {
+    { "IN 5 2", LV_PALETTE_RED },
+    { "IN 5 3", LV_PALETTE_GREEN },
+    { "IN 5 4", LV_PALETTE_BLUE },
+    { },
+};
+
+#define LA_CHAN_MAX (sizeof(la_chan) / sizeof(la_chan[0]) - 1)
+
+static lv_obj_t *la_trace;
+static lv_timer_t *la_timer;
+
+/* Time per column, and the column at the right edge of the trace */
+static uint64_t la_col_ns;
+static uint64_t la_now;
+
+static uint64_t la_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint8_t *la_col(struct la_chan *chan, uint64_t col)
+{
+    return &chan->col[col & (LA_COLS - 1)];
+}
+
+/* Carry the channel's level on, up to and including `col` */
+static void la_fill(struct la_chan *chan, uint64_t col)
+{
+    uint64_t i;
+
+    if (col <= chan->cur)
+        return;
+
+    i = chan->cur + 1;
+    if (col - chan->cur > LA_COLS)
+        i = col - LA_COLS + 1;
+    for (; i <= col; i++)
+        *la_col(chan, i) = chan->level;
+    chan->cur = col;
+}
+
+void la_edge(const struct cap_edge *edge)
+{
+    struct la_chan *chan;
+    uint8_t level = edge->level ? LA_HIGH : LA_LOW;
+    uint64_t col, i;
+
+    if (edge->chan >= LA_CHAN_MAX || la_col_ns == 0)
+        return;
+    chan = &la_chan[edge->chan];
+    col = edge->ts_ns / la_col_ns;
+
+    if (col > chan->cur || chan->level == 0) {
+        la_fill(chan, col - 1);
+        *la_col(chan, col) = chan->level | level;
+        chan->cur = col;
+    } else {
+        /* The trace was already carried on past when the edge happened, it
+         * has been at the new level since
+         */
+        if (chan->cur - col >= LA_COLS)
+            col = chan->cur - LA_COLS + 1;
+        *la_col(chan, col) |= level;
+        for (i = col + 1; i <= chan->cur; i++)
+            *la_col(chan, i) = level;
+    }
+
+    chan->level = level;
+}
+
+static void la_timer_cb(lv_timer_t *timer)
+{
+    unsigned int i;
+
+    la_now = la_now_ns() / la_col_ns;
+    for (i = 0; i < LA_CHAN_MAX; i++) {
+        if (la_chan[i].level != 0)
+            la_fill(&la_chan[i], la_now);
+    }
+
+    lv_obj_invalidate(la_trace);
+}
+
+/* Draw one run of columns that all did the same thing */
+static void la_draw_run(lv_draw_ctx_t *draw_ctx, const struct la_chan *chan,
+  uint8_t what, lv_coord_t x1, lv_coord_t x2, lv_coord_t y_hi,
+  lv_coord_t y_lo)
+{
+    lv_draw_line_dsc_t line_dsc;
+    lv_draw_rect_dsc_t rect_dsc;
+    lv_point_t p1, p2;
+    lv_area_t band;
+
+    if (what == LA_BOTH) {
+        lv_draw_rect_dsc_init(&rect_dsc);
+        rect_dsc.bg_color = lv_palette_main(chan->color);
+        rect_dsc.bg_opa = LV_OPA_70;
+        band.x1 = x1;
+        band.x2 = x2;
+        band.y1 = y_hi;
+        band.y2 = y_lo;
+        lv_draw_rect(draw_ctx, &rect_dsc, &band);
+    } else if (what != 0) {
+        lv_draw_line_dsc_init(&line_dsc);
+        line_dsc.color = lv_palette_main(chan->color);
+        line_dsc.width = 2;
+        p1.x = x1;
+        p2.x = x2;
+        p1.y = p2.y = (what == LA_HIGH) ? y_hi : y_lo;
+        lv_draw_line(draw_ctx, &line_dsc, &p1, &p2);
+    }
+}
+
+/* The vertical edge where a low run meets a high one */
+static void la_draw_edge(lv_draw_ctx_t *draw_ctx, const struct la_chan *chan,
+  lv_coord_t x, lv_coord_t y_hi, lv_coord_t y_lo)
+{
+    lv_draw_line_dsc_t line_dsc;
+    lv_point_t p1 = { x, y_hi };
+    lv_point_t p2 = { x, y_lo };
+
+    lv_draw_line_dsc_init(&line_dsc);
+    line_dsc.color = lv_palette_main(chan->color);
+    line_dsc.width = 2;
+    lv_draw_line(draw_ctx, &line_dsc, &p1, &p2);
+}
+
+static void la_draw_cb(lv_event_t *e)
+{
+    lv_obj_t *obj = lv_event_get_target(e);
+    lv_draw_ctx_t *draw_ctx = lv_event_get_draw_ctx(e);
+    uint64_t start = stats_now_us();
+    struct la_chan *chan;
+    lv_coord_t w, row_h, y_hi, y_lo, x, x0;
+    lv_area_t coords;
+    uint64_t first;
+    uint8_t what, run;
+    unsigned int i;
+
+    lv_obj_get_content_coords(obj, &coords);
+    w = LV_MIN(lv_area_get_width(&coords), LA_COLS);
+    row_h = lv_area_get_height(&coords) / LA_CHAN_MAX;
+    if (la_now < (uint64_t)w)
+        return;
+    first = la_now - w + 1;
+
+    for (i = 0; i < LA_CHAN_MAX; i++) {
+        chan = &la_chan[i];
+        /* Room for the label above the high level */
+        y_hi = coords.y1 + (i * row_h) + (row_h / 3);
+        y_lo = coords.y1 + ((i + 1) * row_h) - LA_PAD;
+
+        run = *la_col(chan, first);
+        x0 = coords.x1;
+        for (x = 1; x <= w; x++) {
+            what = (x < w) ? *la_col(chan, first + x) : 0;
+            if (x < w && what == run)
+                continue;
+
+            la_draw_run(draw_ctx, chan, run, x0, coords.x1 + x - 1, y_hi,
+              y_lo);
+            if (x < w && (run | what) == LA_BOTH && run != LA_BOTH &&
+              what != LA_BOTH)
+                la_draw_edge(draw_ctx, chan, coords.x1 + x, y_hi, y_lo);
+
+            run = what;
+            x0 = coords.x1 + x;
+        }
+    }
+
+    stats_record(STAT_LA_DRAW_US, stats_now_us() - start);
+}
+
+void la_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width)
+{
+    lv_obj_t *label;
+    lv_coord_t row_h;
+    unsigned int i;
+
+    la_trace = lv_obj_create(tab);
+    lv_obj_set_size(la_trace, width, height);
+    lv_obj_center(la_trace);
+    lv_obj_clear_flag(la_trace, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_set_style_bg_color(la_trace, lv_color_black(), LV_PART_MAIN);
+    lv_obj_set_style_border_width(la_trace, 0, LV_PART_MAIN);
+    lv_obj_set_style_pad_all(la_trace, LA_PAD, LV_PART_MAIN);
+    lv_obj_add_event_cb(la_trace, la_draw_cb, LV_EVENT_DRAW_MAIN, NULL);
+
+    /* One column per pixel of the trace */
+    la_col_ns = (LA_WINDOW_MS * 1000000ULL) / (width - (2 * LA_PAD));
+
+    row_h = (height - (2 * LA_PAD)) / LA_CHAN_MAX;
+    for (i = 0; i < LA_CHAN_MAX; i++) {
+        label = lv_label_create(la_trace);
+        lv_label_set_text_static(label, la_chan[i].label);
+        lv_obj_set_style_text_font(label, &lv_font_montserrat_10, LV_PART_MAIN);
+        lv_obj_set_style_text_color(label, lv_palette_main(la_chan[i].color),
+          LV_PART_MAIN);
+        lv_obj_set_pos(label, 0, i * row_h);
+    }
+
+    la_timer = lv_timer_create(la_timer_cb, LA_REFRESH_MS, NULL);
+    lv_timer_pause(la_timer);
+}
+
+void la_set_active(bool active)
+{
+    if (la_timer == NULL)
+        return;
+
+    if (active) {
+        lv_timer_resume(la_timer);
+        lv_timer_ready(la_timer);
+    } else {
+        lv_timer_pause(la_timer);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef __LA_H__
+#define __LA_H__
+#include <stdbool.h>
+
+#include "cap.h"
+
+/* A logic analyzer style trace of the HV inputs, scrolling right to left */
+void la_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width);
+
+/* Feed a captured edge, see cap.h. Edges are taken whether or not the trace
+ * is on screen, so there is history to show when it is switched to.
+ */
+void la_edge(const struct cap_edge *edge);
+
+/* Only scroll and redraw the trace while it is on screen */
+void la_set_active(bool active);
+
+#endif // __LA_H__
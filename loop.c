@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "lvgl/lvgl.h"
+#include "loop.h"
+
+/* The demo only ever has a handful of fds to watch; touchscreen, the timer,
+ * and a few from the I/O side. A small static table is plenty.
+ */
+#define LOOP_MAX_FDS 16
+
+struct loop_src {
+    int fd;
+    loop_fd_cb_t cb;
+    void *user_data;
+};
+
+static struct loop_src loop_src[LOOP_MAX_FDS];
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int wake_fd = -1;
+static void (*prepare_cb)(void);
+
+static void loop_wake_cb(int fd, uint32_t events, void *user_data)
+{
+    loop_efd_drain(fd);
+}
+
+int loop_init(void)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int i;
+
+    for (i = 0; i < LOOP_MAX_FDS; i++)
+        loop_src[i].fd = -1;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        return -1;
+
+    /* CLOCK_MONOTONIC matches custom_tick_get() so that the deadlines that
+     * LVGL hands back line up with the timer we arm here.
+     */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1)
+        goto out_epoll;
+
+    /* The timer is the only source with a NULL data pointer */
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+        goto out_timer;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1)
+        goto out_timer;
+
+    if (loop_add_fd(wake_fd, EPOLLIN, loop_wake_cb, NULL) == -1)
+        goto out_wake;
+
+    return 0;
+
+out_wake:
+    close(wake_fd);
+    wake_fd = -1;
+out_timer:
+    close(timer_fd);
+    timer_fd = -1;
+out_epoll:
+    close(epoll_fd);
+    epoll_fd = -1;
+    return -1;
+}
+
+int loop_add_fd(int fd, uint32_t events, loop_fd_cb_t cb, void *user_data)
+{
+    struct epoll_event ev = { .events = events };
+    int i;
+
+    for (i = 0; i < LOOP_MAX_FDS; i++) {
+        if (loop_src[i].fd == -1)
+            break;
+    }
+    if (i == LOOP_MAX_FDS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    ev.data.ptr = &loop_src[i];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+
+    loop_src[i].fd = fd;
+    loop_src[i].cb = cb;
+    loop_src[i].user_data = user_data;
+
+    return 0;
+}
+
+void loop_del_fd(int fd)
+{
+    int i;
+
+    for (i = 0; i < LOOP_MAX_FDS; i++) {
+        if (loop_src[i].fd == fd) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            loop_src[i].fd = -1;
+            break;
+        }
+    }
+}
+
+void loop_set_prepare_cb(void (*cb)(void))
+{
+    prepare_cb = cb;
+}
+
+void loop_efd_signal(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        perror("eventfd write");
+}
+
+uint64_t loop_efd_drain(int fd)
+{
+    uint64_t cnt;
+
+    if (read(fd, &cnt, sizeof(cnt)) == -1) {
+        if (errno != EAGAIN)
+            perror("eventfd read");
+        return 0;
+    }
+
+    return cnt;
+}
+
+void loop_wake(void)
+{
+    loop_efd_signal(wake_fd);
+}
+
+/* Arm the timerfd to an absolute deadline of `ms` from now, or disarm it
+ * entirely if LVGL has no running timers. A paused timer (e.g. the display
+ * refresh when nothing is invalidated) is not counted by LVGL, so an idle UI
+ * ends up here with the timer disarmed and sleeps until an fd wakes it.
+ */
+static void loop_timer_arm(uint32_t ms)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (ms != LV_NO_TIMER_READY) {
+        clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+        its.it_value.tv_sec += ms / 1000;
+        its.it_value.tv_nsec += (ms % 1000) * 1000000L;
+        if (its.it_value.tv_nsec >= 1000000000L) {
+            its.it_value.tv_sec++;
+            its.it_value.tv_nsec -= 1000000000L;
+        }
+    }
+
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void loop_run(void)
+{
+    struct epoll_event ev[LOOP_MAX_FDS];
+    struct loop_src *src;
+    uint32_t next;
+    int n, i;
+
+    while (1) {
+        next = lv_timer_handler();
+        if (prepare_cb != NULL)
+            prepare_cb();
+
+        /* A timer that is already due does not need the timerfd round trip,
+         * just check for fd activity without blocking and go around again.
+         */
+        if (next == 0) {
+            n = epoll_wait(epoll_fd, ev, LOOP_MAX_FDS, 0);
+        } else {
+            loop_timer_arm(next);
+            n = epoll_wait(epoll_fd, ev, LOOP_MAX_FDS, -1);
+        }
+
+        for (i = 0; i < n; i++) {
+            src = ev[i].data.ptr;
+            if (src == NULL) {
+                /* Only the expiration count needs draining, the timer firing
+                 * just means lv_timer_handler() is due again. EAGAIN here is
+                 * fine, it was re-armed after it fired.
+                 */
+                loop_efd_drain(timer_fd);
+                continue;
+            }
+
+            /* A callback may have removed this, or a later, source */
+            if (src->fd != -1)
+                src->cb(src->fd, ev[i].events, src->user_data);
+        }
+    }
+}
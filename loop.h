@@ -0,0 +1,46 @@
+#ifndef __LOOP_H__
+#define __LOOP_H__
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/* Called from the UI thread whenever a registered fd reports any of the
+ * requested epoll events. LVGL calls are safe from inside the callback.
+ */
+typedef void (*loop_fd_cb_t)(int fd, uint32_t events, void *user_data);
+
+/* Set up the epoll instance and the timerfd used to wake up for the next
+ * LVGL timer deadline. Returns -1 on error.
+ */
+int loop_init(void);
+
+/* Returns -1 on error, e.g. if all of the slots are in use */
+int loop_add_fd(int fd, uint32_t events, loop_fd_cb_t cb, void *user_data);
+
+void loop_del_fd(int fd);
+
+/* Called on every pass of the loop, after LVGL's timers have run and right
+ * before going to sleep. Used to drive work that isn't timer based, e.g. a
+ * display refresh paced by page flips.
+ */
+void loop_set_prepare_cb(void (*cb)(void));
+
+/* Wake the loop for another pass. Safe to call from any thread. */
+void loop_wake(void);
+
+/* Add 1 to an eventfd's count, from any thread. A count that is already as
+ * high as it goes has its reader due anyway, so only other errors are
+ * reported.
+ */
+void loop_efd_signal(int fd);
+
+/* Take the count of an eventfd, or the expirations of a timerfd. Returns 0
+ * if there was nothing to take, e.g. another wakeup already took it.
+ */
+uint64_t loop_efd_drain(int fd);
+
+/* Run LVGL's timers and sleep until either the next timer is due or one of
+ * the registered fds has work. Never returns.
+ */
+void loop_run(void);
+
+#endif // __LOOP_H__
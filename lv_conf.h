@@ -30,7 +30,12 @@ extern uint32_t custom_tick_get(void);
  *====================*/
 
 /*Color depth: 1 (1 byte per pixel), 8 (RGB332), 16 (RGB565), 32 (ARGB8888)*/
-#define LV_COLOR_DEPTH 32 
+/*16 matches the panel, so everything is rendered in RGB565 and flushing is a
+ *plain copy. Build LVGL, its drivers, and the demo with -DLV_COLOR_DEPTH=32
+ *to compare against 32 bit rendering.*/
+#ifndef LV_COLOR_DEPTH
+#define LV_COLOR_DEPTH 16
+#endif
 
 /*Swap the 2 bytes of RGB565 color. Useful if the display has an 8-bit interface (e.g. SPI)*/
 #define LV_COLOR_16_SWAP 0
@@ -537,7 +542,7 @@ extern uint32_t custom_tick_get(void);
     #define LV_USE_CALENDAR_HEADER_DROPDOWN 1
 #endif  /*LV_USE_CALENDAR*/
 
-#define LV_USE_CHART      0
+#define LV_USE_CHART      1
 
 #define LV_USE_COLORWHEEL 0
 
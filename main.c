@@ -1,19 +1,39 @@
 #include "lvgl/lvgl.h"
-#include "lv_drivers/display/fbdev.h"
 #include "lv_drivers/indev/libinput_drv.h"
+#include <libinput.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <time.h>
-#include <sys/time.h>
 
+#include "acq.h"
+#include "adclog.h"
+#include "cap.h"
+#include "disp.h"
 #include "gpio.h"
+#include "hist.h"
+#include "io.h"
+#include "la.h"
+#include "loop.h"
 #include "meter.h"
+#include "stats.h"
+#include "trend.h"
 
-#define DISP_BUF_SIZE (128 * 1024)
-
-/* Width of tab on right side of screen */
+/* Width of tab on right side of screen, or its height along the bottom when
+ * the UI is laid out portrait.
+ */
 #define TAB_W 50
 
+/* Idle time on the Pinout tab before the tabs are hidden */
+#define TAB_FADEOUT_MS 1500
+
+/* Tab indices, in the order they are added in lv_tab_test_setup() */
+#define TAB_PINOUT 0
+#define TAB_ADC 3
+#define TAB_LOGIC 4
+#define TAB_TREND 5
+
 LV_IMG_DECLARE(ts7100z_label_20220324);
 
 /* The following two callbacks work in tandem with the touch_timer variable.
@@ -21,10 +41,12 @@ LV_IMG_DECLARE(ts7100z_label_20220324);
  * there is a touch timeout/idle counter. This way the tabview tabs show on
  * the screen before disappearing.
  *
- * The timer continually runs, rather often, during this time in order to catch
- * touchscreen input as soon as possible. This is so if the user immediately
- * scrolls, the tabs show up quickly and the tab windows render correctly during
- * scroll.
+ * Rather than polling the idle time, the timer period is set to expire right
+ * when the tabs are due to be hidden. Once hidden, the timer is paused so an
+ * idle Pinout screen costs no wakeups at all. A touch is seen by
+ * touch_read_cb() which makes the timer ready again, so the tabs show up as
+ * soon as the user starts touching and the tab windows render correctly
+ * during scroll.
  *
  * If/when the pinout tab is no longer selected, the timer is deleted and the
  * tabview is forced to be always on. If the pinout tab is ever selected again,
@@ -37,22 +59,26 @@ lv_style_t style_splash_label;
 static void timer_tab_fadeout_cb(lv_timer_t *timer)
 {
     lv_obj_t *tv = timer->user_data;
+    uint32_t inactive = lv_disp_get_inactive_time(NULL);
 
-
-    if (lv_disp_get_inactive_time(NULL) > 1500) {
+    if (inactive > TAB_FADEOUT_MS) {
         lv_obj_add_flag(lv_tabview_get_tab_btns(tv), LV_OBJ_FLAG_HIDDEN);
+        lv_timer_pause(timer);
     } else {
         lv_obj_clear_flag(lv_tabview_get_tab_btns(tv), LV_OBJ_FLAG_HIDDEN);
+        lv_timer_set_period(timer, TAB_FADEOUT_MS - inactive + 1);
     }
 }
 
 static void tab_change_event_cb(lv_event_t *e)
 {
     lv_obj_t *tv = lv_event_get_current_target(e);
+    uint16_t tab = lv_tabview_get_tab_act(tv);
 
-    if (lv_tabview_get_tab_act(tv) == 0) {
+    if (tab == TAB_PINOUT) {
         if (touch_timer == NULL) {
-            touch_timer = lv_timer_create(timer_tab_fadeout_cb, 10, tv);
+            touch_timer = lv_timer_create(timer_tab_fadeout_cb,
+              TAB_FADEOUT_MS, tv);
         }
     } else {
         if (touch_timer != NULL) {
@@ -66,6 +92,10 @@ static void tab_change_event_cb(lv_event_t *e)
          * application to be run, but all of the GPIO still usable by the rest
          * of the system until the tab is transitioned.
          *
+         * Both only post the claim to the I/O thread, the lines are opened
+         * there and the controls are enabled once it's done, so the switch
+         * itself never waits on the GPIO chips.
+         *
          * gpio_claim_all_and_set_cb() is safe to run multiple times, however,
          * it must be run after all of the button objects are set up otherwise
          * it will consider the GPIO initialized but will have not actually
@@ -74,6 +104,27 @@ static void tab_change_event_cb(lv_event_t *e)
         gpio_claim_all_and_set_cb();
         gpio_adc_setup();
     }
+
+    /* Only move the meter, scroll the logic analyzer, or refresh the trend
+     * while each is on screen. The input LEDs are driven by edge events and
+     * cost nothing while idle.
+     */
+    meter_set_active(tab == TAB_ADC);
+    la_set_active(tab == TAB_LOGIC);
+    trend_set_active(tab == TAB_TREND);
+}
+
+/* The worst frame from when the tabs start scrolling, by a swipe or a tap on
+ * a tab button, until they have settled on the new tab. This covers all the
+ * work of a tab change, including the first, and whatever the frames around
+ * it cost, rather than just the handler.
+ */
+static void tab_scroll_event_cb(lv_event_t *e)
+{
+    if (lv_event_get_code(e) == LV_EVENT_SCROLL_BEGIN)
+        disp_frame_max_take();
+    else
+        stats_record(STAT_TAB_SWITCH_MS, disp_frame_max_take());
 }
 
 lv_obj_t *flex_obj_create(lv_obj_t *cont, int h, int w)
@@ -92,17 +143,31 @@ lv_obj_t *flex_obj_create(lv_obj_t *cont, int h, int w)
 
 static void lv_tab_test_setup(void)
 {
+    bool portrait = (LV_HOR_RES < LV_VER_RES);
     lv_coord_t width = LV_HOR_RES-TAB_W;
     lv_coord_t height = LV_VER_RES;
     lv_obj_t * tv;
     lv_obj_t * tab;
 
+    /* Rendering in the panel's own orientation, the tabs move to the bottom
+     * and the tab contents are laid out tall rather than wide.
+     */
+    if (portrait) {
+        width = LV_HOR_RES;
+        height = LV_VER_RES-TAB_W;
+    }
+
     lv_theme_default_init(NULL, lv_color_black(),
       lv_color_hex(0xf77f00), LV_THEME_DEFAULT_DARK,
       &lv_font_montserrat_14);
 
-    tv = lv_tabview_create(lv_scr_act(), LV_DIR_RIGHT, TAB_W);
+    tv = lv_tabview_create(lv_scr_act(),
+      portrait ? LV_DIR_BOTTOM : LV_DIR_RIGHT, TAB_W);
     lv_obj_add_event_cb(tv, tab_change_event_cb, LV_EVENT_VALUE_CHANGED, NULL);
+    lv_obj_add_event_cb(lv_tabview_get_content(tv), tab_scroll_event_cb,
+      LV_EVENT_SCROLL_BEGIN, NULL);
+    lv_obj_add_event_cb(lv_tabview_get_content(tv), tab_scroll_event_cb,
+      LV_EVENT_SCROLL_END, NULL);
 
     /* Set tabview background color of the main views */
     lv_obj_set_style_bg_color(tv, lv_color_black(), LV_PART_MAIN);
@@ -119,7 +184,15 @@ static void lv_tab_test_setup(void)
     lv_obj_t *image = lv_img_create(tab);
     lv_obj_align_to(image, lv_scr_act(), LV_ALIGN_TOP_LEFT, 0, 19);
     lv_img_set_src(image, &ts7100z_label_20220324);
-    touch_timer = lv_timer_create(timer_tab_fadeout_cb, 10, tv);
+    /* The image is landscape, scale it down to the panel's width. This only
+     * costs anything when the Pinout tab is redrawn.
+     */
+    if (portrait) {
+        lv_img_set_pivot(image, 0, 0);
+        lv_img_set_zoom(image, (LV_IMG_ZOOM_NONE * LV_HOR_RES) /
+          ts7100z_label_20220324.header.w);
+    }
+    touch_timer = lv_timer_create(timer_tab_fadeout_cb, TAB_FADEOUT_MS, tv);
     lv_obj_t *label_splash = lv_label_create(image);
     lv_style_init(&style_splash_label);
     lv_style_set_text_font(&style_splash_label, &lv_font_montserrat_20);
@@ -142,69 +215,216 @@ static void lv_tab_test_setup(void)
     tab = lv_tabview_add_tab(tv, "ADC");
     lv_obj_clear_flag(tab, LV_OBJ_FLAG_SCROLLABLE);
     lv_meter(tab, height, width);
+
+    /* Create a tab with a logic analyzer trace of the HV inputs */
+    tab = lv_tabview_add_tab(tv, "Logic");
+    lv_obj_clear_flag(tab, LV_OBJ_FLAG_SCROLLABLE);
+    la_create(tab, height, width);
+
+    /* Create a tab with a trend chart of the ADC history */
+    tab = lv_tabview_add_tab(tv, "Trend");
+    lv_obj_clear_flag(tab, LV_OBJ_FLAG_SCROLLABLE);
+    trend_create(tab, height, width);
 }
 
-int main(void)
+/* The touchscreen is read when libinput's fd has events, rather than by
+ * LVGL's indev timer polling every LV_INDEV_DEF_READ_PERIOD. While the panel
+ * is being touched the read timer is left running so that LVGL can still
+ * track presses, long presses, and scroll momentum with no new events coming
+ * in. After release it keeps running until any scroll has finished throwing
+ * and snapped into place, then the timer is paused again.
+ */
+static libinput_drv_state_t touch_state;
+static lv_indev_t *touch_indev;
+
+static void touch_read_cb(lv_indev_drv_t *drv, lv_indev_data_t *data)
 {
+    libinput_read_state(&touch_state, drv, data);
+    disp_map_point(&data->point);
+
+    if (data->state == LV_INDEV_STATE_PRESSED) {
+        lv_timer_resume(drv->read_timer);
+        /* Bring the tabs back, see timer_tab_fadeout_cb() */
+        if (touch_timer != NULL) {
+            lv_timer_resume(touch_timer);
+            lv_timer_ready(touch_timer);
+        }
+    } else if (touch_indev->proc.types.pointer.scroll_obj == NULL) {
+        lv_timer_pause(drv->read_timer);
+    }
+}
+
+static void touch_fd_cb(int fd, uint32_t events, void *user_data)
+{
+    lv_indev_read_timer_cb(touch_indev->driver->read_timer);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s] [-d drm|fbdev] [-r hw|native|sw] "
+      "[-m copy|direct] [-l DIR] [-p CHIP.LINE=PROGRAM]...\n"
+      "  -d  Display backend, by default DRM/KMS falling back to fbdev\n"
+      "  -l  Log every ADC sample to segment files in DIR, which must exist.\n"
+      "      The ADC's GPIO are claimed at startup rather than on first use\n"
+      "  -r  Rotation, by default landscape rotated by the display hardware\n"
+      "      falling back to a portrait UI (native). sw keeps the landscape\n"
+      "      UI and rotates it in software\n"
+      "  -m  Render into draw buffers that are copied out (copy), or straight\n"
+      "      into the display's memory where possible (direct)\n"
+      "  -p  Drive an output from the sequencer once the GPIO are claimed,\n"
+      "      with one of the programs below, times in microseconds:\n"
+      "        pulse:ON:OFF:COUNT     COUNT pulses, 0 for no end\n"
+      "        pwm:PERIOD:DUTY        DUTY in percent\n"
+      "        sched:L/T,L/T,...:N    level L for T, N passes, 0 for no end\n"
+      "      e.g. -p 4.4=pulse:500000:500000:10 for relay 1\n"
+      "  -s  Print frame and I/O timing statistics once a second\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    enum disp_rotation rotation = DISP_ROT_HW;
+    const char *display = NULL;
+    const char *log_dir = NULL;
+    bool direct = false;
+    bool stats = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:l:m:p:r:sh")) != -1) {
+        switch (opt) {
+        case 'd':
+            display = optarg;
+            break;
+        case 'l':
+            log_dir = optarg;
+            break;
+        case 'm':
+            if (strcmp(optarg, "direct") == 0) {
+                direct = true;
+            } else if (strcmp(optarg, "copy") == 0) {
+                direct = false;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (gpio_seq_add(optarg) == -1) {
+                fprintf(stderr, "Bad sequencer output or program: %s\n",
+                  optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (strcmp(optarg, "hw") == 0) {
+                rotation = DISP_ROT_HW;
+            } else if (strcmp(optarg, "native") == 0) {
+                rotation = DISP_ROT_NATIVE;
+            } else if (strcmp(optarg, "sw") == 0) {
+                rotation = DISP_ROT_SW;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            stats = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
     /*LittlevGL init*/
     lv_init();
 
-    /*Linux frame buffer device init*/
-    fbdev_init();
-
-    /*A small buffer for LittlevGL to draw the screen's content*/
-    static lv_color_t buf[DISP_BUF_SIZE];
+    if (loop_init() == -1) {
+        perror("loop_init");
+        return 1;
+    }
 
-    /*Initialize a descriptor for the buffer*/
-    static lv_disp_draw_buf_t disp_buf;
-    lv_disp_draw_buf_init(&disp_buf, buf, NULL, DISP_BUF_SIZE);
+    if (stats)
+        stats_enable();
 
-    /*Initialize and register a display driver*/
-    static lv_disp_drv_t disp_drv;
-    lv_disp_drv_init(&disp_drv);
-    disp_drv.draw_buf   = &disp_buf;
-    disp_drv.flush_cb   = fbdev_flush;
-    disp_drv.hor_res    = 240;
-    disp_drv.ver_res    = 320;
-    disp_drv.sw_rotate  = 1;
-    disp_drv.rotated    = LV_DISP_ROT_270;
-    lv_disp_drv_register(&disp_drv);
+    /*DRM/KMS or frame buffer device and display driver init*/
+    if (disp_init(display, rotation, direct) == NULL) {
+        perror("disp_init");
+        return 1;
+    }
 
-    libinput_init();
+    libinput_init_state(&touch_state, LIBINPUT_NAME);
     static lv_indev_drv_t indev_drv_1;
     lv_indev_drv_init(&indev_drv_1); /*Basic initialization*/
     indev_drv_1.type = LV_INDEV_TYPE_POINTER;
 
-    /*This function will be called periodically (by the library) to get the mouse position and state*/
-    indev_drv_1.read_cb = libinput_read;
-    lv_indev_t *mouse_indev = lv_indev_drv_register(&indev_drv_1);
+    /*Called when libinput has events, and periodically while touched*/
+    indev_drv_1.read_cb = touch_read_cb;
+    touch_indev = lv_indev_drv_register(&indev_drv_1);
+    lv_timer_pause(touch_indev->driver->read_timer);
+    loop_add_fd(libinput_get_fd(touch_state.libinput_context), EPOLLIN,
+      touch_fd_cb, NULL);
 
     /*Create a Demo*/
     lv_tab_test_setup();
 
-    /*Handle LitlevGL tasks (tickless mode)*/
-    while(1) {
-        lv_timer_handler();
-        usleep(5000);
+    /*Keep the ADC's history, the trend is left empty without it*/
+    if (hist_init() == -1)
+        perror("hist_init");
+
+    /*Log the ADC, the segments are recovered on the logger's own thread*/
+    if (log_dir != NULL && adclog_start(log_dir) == -1) {
+        perror(log_dir);
+        return 1;
+    }
+
+    /*Start sampling the I/O shown by the demo*/
+    if (acq_start() == -1) {
+        perror("acq_start");
+        return 1;
+    }
+
+    /*Set up capture of the inputs' edges, done by the I/O thread*/
+    if (cap_start() == -1) {
+        perror("cap_start");
+        return 1;
+    }
+
+    /*Start the thread that writes the outputs for the demo*/
+    if (io_start() == -1) {
+        perror("io_start");
+        return 1;
     }
 
+    /*Logging can't wait for the Pinout tab to be left, so the ADC's mode
+     *lines are claimed and sampling starts straight away
+     */
+    if (log_dir != NULL)
+        gpio_adc_setup();
+
+    /*Handle LitlevGL tasks, sleeping until there is something to do*/
+    loop_run();
+
     return 0;
 }
 
 /*Set in lv_conf.h as `LV_TICK_CUSTOM_SYS_TIME_EXPR`*/
+/* Uses CLOCK_MONOTONIC, the same clock the main loop's timerfd is armed with,
+ * so wall clock changes can't stall or rush LVGL's timers.
+ */
 uint32_t custom_tick_get(void)
 {
     static uint64_t start_ms = 0;
+    struct timespec ts;
+
     if(start_ms == 0) {
-        struct timeval tv_start;
-        gettimeofday(&tv_start, NULL);
-        start_ms = (tv_start.tv_sec * 1000000 + tv_start.tv_usec) / 1000;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        start_ms = (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
     }
 
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
     uint64_t now_ms;
-    now_ms = (tv_now.tv_sec * 1000000 + tv_now.tv_usec) / 1000;
+    now_ms = (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
 
     uint32_t time_ms = now_ms - start_ms;
     return time_ms;
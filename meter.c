@@ -1,8 +1,9 @@
 #include <stdio.h>
-#include <iio.h>
 
 #include "lvgl/lvgl.h"
+#include "acq.h"
 #include "gpiolib1.h"
+#include "io.h"
 #include "main.h"
 #include "meter.h"
 
@@ -13,6 +14,7 @@ struct gpio_desc {
     int oval;
 };
 
+/* In the same order as adc_desc. Driven high, the input is in 0-20 mA mode. */
 static struct gpio_desc gpio_adc_desc[] = {
     { "/dev/gpiochip5", 9, NULL, 0},
     { "/dev/gpiochip5", 10, NULL, 0},
@@ -21,10 +23,30 @@ static struct gpio_desc gpio_adc_desc[] = {
     {},
 };
 
+/* Nominal calibration from mV at the ADC. 0-12 V inputs are divided down to
+ * 13.325 V at the 3.3 V full scale, and in current mode 20 mA reads full
+ * scale. A unit calibrated on the bench would give each channel its own.
+ */
+static const struct acq_adc_cal adc_cal_nominal[ACQ_ADC_MODE_MAX] = {
+    [ACQ_ADC_VOLTAGE] = { 13325.0 / 3300, 0 },
+    [ACQ_ADC_CURRENT] = { 20000.0 / 3300, 0 },
+};
+
+/* Single sample spikes are thrown away, and what is left smoothed with a
+ * time constant of a few samples, around a quarter of a second.
+ */
+static const struct dsp_chan_cfg adc_filter_default = {
+    .median = true,
+    .alpha = DSP_ALPHA_ONE / 4,
+};
+
 static lv_style_t style_legend;
+static bool meter_active;
 struct lv_adc_meter {
     const char *chan_name;
-    struct iio_channel *iio_chan;
+    const struct acq_adc_cal *cal;
+    const struct dsp_chan_cfg *filter;
+    int chan;
     lv_obj_t *meter;
     lv_meter_indicator_t * indic;
     lv_palette_t color;
@@ -33,10 +55,10 @@ struct lv_adc_meter {
 };
 
 static struct lv_adc_meter adc_desc[] = {
-    { "voltage5", NULL, NULL, NULL, LV_PALETTE_RED, "ADC 5", {0} },
-    { "voltage8", NULL, NULL, NULL, LV_PALETTE_GREEN, "ADC 8", {0} },
-    { "voltage9", NULL, NULL, NULL, LV_PALETTE_BLUE, "ADC 9", {0} },
-    { "voltage0", NULL, NULL, NULL, LV_PALETTE_ORANGE, "ADC 0", {0} },
+    { "voltage5", adc_cal_nominal, &adc_filter_default, -1, NULL, NULL, LV_PALETTE_RED, "ADC 5", {0} },
+    { "voltage8", adc_cal_nominal, &adc_filter_default, -1, NULL, NULL, LV_PALETTE_GREEN, "ADC 8", {0} },
+    { "voltage9", adc_cal_nominal, &adc_filter_default, -1, NULL, NULL, LV_PALETTE_BLUE, "ADC 9", {0} },
+    { "voltage0", adc_cal_nominal, &adc_filter_default, -1, NULL, NULL, LV_PALETTE_ORANGE, "ADC 0", {0} },
     { },
 };
 
@@ -48,8 +70,23 @@ static void meter_scale_cb(lv_event_t *e)
     }
 }
 
+/* Runs on the I/O thread */
+static int gpio_adc_claim(void *user_data)
+{
+    int i;
+
+    for (i = 0; ; i++) {
+        if (gpio_adc_desc[i].chip_path == NULL) break;
+        gpio_adc_desc[i].gpio = gpio_alloc(gpio_adc_desc[i].chip_path,
+            gpio_adc_desc[i].line, 1, gpio_adc_desc[i].oval);
+    }
+
+    return 0;
+}
+
 /* This sets up the GPIO pins that dictate if the ADC are in 0-12 V or 0-20 mA
- * modes.
+ * modes. The claim is left to the I/O thread so it can't hitch the UI. Each
+ * channel is converted with the calibration of the mode it is put in.
  */
 static bool gpio_is_init;
 void gpio_adc_setup(void)
@@ -58,13 +95,16 @@ void gpio_adc_setup(void)
 
     if (gpio_is_init) return;
 
-    for (i = 0; ; i++) {
-        if (gpio_adc_desc[i].chip_path == NULL) break;
-        gpio_adc_desc[i].gpio = gpio_alloc(gpio_adc_desc[i].chip_path,
-            gpio_adc_desc[i].line, 1, gpio_adc_desc[i].oval);
+    for (i = 0; gpio_adc_desc[i].chip_path != NULL; i++) {
+        acq_adc_set_mode(adc_desc[i].chan, gpio_adc_desc[i].oval ?
+          ACQ_ADC_CURRENT : ACQ_ADC_VOLTAGE);
     }
 
-    gpio_is_init = true;
+    if (io_call(gpio_adc_claim, NULL, NULL) == 0)
+        gpio_is_init = true;
+
+    /* From here on the ADC is sampled for good, to keep its history */
+    acq_set_active(ACQ_ADC, true);
 }
 
 static void adc_set_value(void * d, int32_t v)
@@ -73,23 +113,34 @@ static void adc_set_value(void * d, int32_t v)
     lv_meter_set_indicator_end_value(desc->meter, desc->indic, v);
 }
 
-/* Animation causes the arc to behave similar to an analog voltmeter needle.
- * Large changes are traversed fairly quickly, but as the needle reaches its
- * limit, or the changes are small, it is slow to settle.
+/* Samples are taken by the acquisition thread, this only runs on the UI
+ * thread as they are drained from its ring. They are already calibrated to
+ * mV and filtered by then, so the smoothing is done. The animation only
+ * glides the arc from one sample to the next rather than stepping it. The
+ * history is fed on the acquisition thread, so samples are only handed over
+ * while the meter is on screen.
  */
-static void my_timer(lv_timer_t *timer)
+static void adc_sample_cb(const struct acq_sample *s)
 {
-    struct lv_adc_meter *desc = timer->user_data;
-    long long sample;
+    struct lv_adc_meter *desc;
+    long long sample = s->value;
+    int i;
+
+    for (i = 0; ; i++) {
+        if (adc_desc[i].chan_name == NULL) return;
+        if (adc_desc[i].chan == s->chan) break;
+    }
+    desc = &adc_desc[i];
 
-    iio_channel_attr_read_longlong(desc->iio_chan, "raw", &sample);
-    sample = sample * 13325 / 4095;
+    /* Any still in the ring from before the tab was left */
+    if (!meter_active)
+        return;
 
     lv_anim_del(&desc->anim, adc_set_value);
     lv_anim_init(&desc->anim);
     lv_anim_set_exec_cb(&desc->anim, adc_set_value);
     lv_anim_set_values(&desc->anim, desc->indic->end_value, sample);
-    lv_anim_set_time(&desc->anim, 300);
+    lv_anim_set_time(&desc->anim, 60);
     lv_anim_set_var(&desc->anim, desc);
     lv_anim_start(&desc->anim);
 }
@@ -99,9 +150,6 @@ static void my_timer(lv_timer_t *timer)
  */
 void lv_meter(lv_obj_t *tab, int h, int w)
 {
-    /* XXX: These probably don't need to be static */
-    static struct iio_context *ctx;
-    static struct iio_device *dev;
     lv_obj_t * meter;
     int i;
 
@@ -121,15 +169,14 @@ void lv_meter(lv_obj_t *tab, int h, int w)
     lv_obj_clear_flag(meter, LV_OBJ_FLAG_SCROLLABLE);
 
 
-    /* IIO setup */
-    ctx = iio_create_default_context();
-    dev = iio_context_find_device(ctx, "2198000.adc");
+    /* The IIO channels themselves are opened by the acquisition thread */
     for (i = 0; ; i++) {
         if (adc_desc[i].chan_name == NULL) break;
-        adc_desc[i].iio_chan = iio_device_find_channel(dev,
-            adc_desc[i].chan_name, false);
+        adc_desc[i].chan = acq_adc_add(adc_desc[i].chan_name, adc_desc[i].cal,
+          adc_desc[i].filter);
         adc_desc[i].meter = meter;
     }
+    acq_set_cb(ACQ_ADC, adc_sample_cb);
 
     /*Remove the circle from the middle*/
     lv_obj_remove_style(meter, NULL, LV_PART_INDICATOR);
@@ -160,7 +207,6 @@ void lv_meter(lv_obj_t *tab, int h, int w)
         if (adc_desc[i].chan_name == NULL) break;
         adc_desc[i].indic = lv_meter_add_arc(adc_desc[i].meter, scale, 10,
             lv_palette_main(adc_desc[i].color), i * -10);
-        lv_timer_create(my_timer, 100, &adc_desc[i]);
 
         lv_obj_t *label_arc = lv_label_create(meter);
         lv_label_set_text_static(label_arc, adc_desc[i].legend);
@@ -170,3 +216,9 @@ void lv_meter(lv_obj_t *tab, int h, int w)
     }
 }
 
+
+void meter_set_active(bool active)
+{
+    meter_active = active;
+    acq_set_notify(ACQ_ADC, active);
+}
@@ -4,4 +4,9 @@
 void gpio_adc_setup(void);
 void lv_meter(lv_obj_t *tab, int h, int w);
 
+/* Only move the meter's arcs while it is on screen. The ADC is sampled from
+ * gpio_adc_setup() on, whatever is showing, for its history.
+ */
+void meter_set_active(bool active);
+
 #endif // __METER_H__
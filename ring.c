@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+int ring_init(struct ring *ring, unsigned int slots, size_t elem_size)
+{
+    if (slots == 0 || (slots & (slots - 1)) != 0)
+        return -1;
+
+    ring->data = calloc(slots, elem_size);
+    if (ring->data == NULL)
+        return -1;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = slots - 1;
+    ring->elem_size = elem_size;
+
+    return 0;
+}
+
+void ring_free(struct ring *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+}
+
+bool ring_push(struct ring *ring, const void *elem)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask)
+        return false;
+
+    memcpy(ring->data + (head & ring->mask) * ring->elem_size, elem,
+      ring->elem_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+bool ring_pop(struct ring *ring, void *elem)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    memcpy(elem, ring->data + (tail & ring->mask) * ring->elem_size,
+      ring->elem_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+unsigned int ring_count(struct ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+      atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
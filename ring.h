@@ -0,0 +1,43 @@
+#ifndef __RING_H__
+#define __RING_H__
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lock-free single-producer/single-consumer ring of fixed size elements.
+ *
+ * Exactly one thread may push and exactly one thread may pop. The head is
+ * only written by the producer and the tail only by the consumer, so no
+ * locking is needed; acquire/release ordering on the indices is what makes
+ * the element data visible to the other side.
+ *
+ * The number of slots must be a power of 2. The indices are free running and
+ * wrap naturally, so every slot is usable.
+ */
+struct ring {
+    /* Keep producer and consumer indices on separate cache lines so the two
+     * threads don't bounce a shared line on every push/pop.
+     */
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) unsigned int mask;
+    size_t elem_size;
+    uint8_t *data;
+};
+
+/* Returns -1 if the slot count is not a power of 2 or allocation fails */
+int ring_init(struct ring *ring, unsigned int slots, size_t elem_size);
+
+void ring_free(struct ring *ring);
+
+/* Producer side, returns false if the ring is full and `elem` was dropped */
+bool ring_push(struct ring *ring, const void *elem);
+
+/* Consumer side, returns false if the ring is empty */
+bool ring_pop(struct ring *ring, void *elem);
+
+/* Either side, approximate by the time it returns */
+unsigned int ring_count(struct ring *ring);
+
+#endif // __RING_H__
@@ -0,0 +1,257 @@
+#include <stdint.h>
+
+/* Built with NO_SIMD, only the plain C path is used */
+#if !defined(NO_SIMD) && defined(__ARM_NEON)
+#define ROTATE_NEON
+#include <arm_neon.h>
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define ROTATE_SSE2
+#include <immintrin.h>
+#endif
+
+#include "rotate.h"
+
+/* Both rotations are a transpose. Walking the source rows bottom up gives a
+ * clockwise turn, walking the destination rows bottom up a counter-clockwise
+ * one, so the kernels below only ever transpose and the direction is down to
+ * the sign of the strides they are handed.
+ *
+ * The transpose is done a tile at a time, with each tile held in registers,
+ * and tiles are visited a block at a time so the source and destination
+ * lines of a block stay in cache. Strides in here are in pixels.
+ */
+
+/* Pixels per side of the blocks the tiles are visited in */
+#define ROT_BLOCK 32
+
+#if defined(ROTATE_NEON)
+#define TILE32 4
+#define TILE16 8
+
+static inline void tile32(uint32_t *dst, ptrdiff_t ds, const uint32_t *src,
+  ptrdiff_t ss)
+{
+    uint32x4x2_t p01, p23;
+
+    p01 = vtrnq_u32(vld1q_u32(src), vld1q_u32(src + ss));
+    p23 = vtrnq_u32(vld1q_u32(src + (2 * ss)), vld1q_u32(src + (3 * ss)));
+
+    vst1q_u32(dst, vcombine_u32(vget_low_u32(p01.val[0]),
+      vget_low_u32(p23.val[0])));
+    vst1q_u32(dst + ds, vcombine_u32(vget_low_u32(p01.val[1]),
+      vget_low_u32(p23.val[1])));
+    vst1q_u32(dst + (2 * ds), vcombine_u32(vget_high_u32(p01.val[0]),
+      vget_high_u32(p23.val[0])));
+    vst1q_u32(dst + (3 * ds), vcombine_u32(vget_high_u32(p01.val[1]),
+      vget_high_u32(p23.val[1])));
+}
+
+static inline void tile16(uint16_t *dst, ptrdiff_t ds, const uint16_t *src,
+  ptrdiff_t ss)
+{
+    uint16x8x2_t t01, t23, t45, t67;
+    uint32x4x2_t u0, u1, u2, u3;
+
+    t01 = vtrnq_u16(vld1q_u16(src), vld1q_u16(src + ss));
+    t23 = vtrnq_u16(vld1q_u16(src + (2 * ss)), vld1q_u16(src + (3 * ss)));
+    t45 = vtrnq_u16(vld1q_u16(src + (4 * ss)), vld1q_u16(src + (5 * ss)));
+    t67 = vtrnq_u16(vld1q_u16(src + (6 * ss)), vld1q_u16(src + (7 * ss)));
+
+    u0 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[0]),
+      vreinterpretq_u32_u16(t23.val[0]));
+    u1 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[1]),
+      vreinterpretq_u32_u16(t23.val[1]));
+    u2 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[0]),
+      vreinterpretq_u32_u16(t67.val[0]));
+    u3 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[1]),
+      vreinterpretq_u32_u16(t67.val[1]));
+
+#define COL(lh, a, b) \
+    vreinterpretq_u16_u32(vcombine_u32(vget_##lh##_u32(a), vget_##lh##_u32(b)))
+    vst1q_u16(dst, COL(low, u0.val[0], u2.val[0]));
+    vst1q_u16(dst + ds, COL(low, u1.val[0], u3.val[0]));
+    vst1q_u16(dst + (2 * ds), COL(low, u0.val[1], u2.val[1]));
+    vst1q_u16(dst + (3 * ds), COL(low, u1.val[1], u3.val[1]));
+    vst1q_u16(dst + (4 * ds), COL(high, u0.val[0], u2.val[0]));
+    vst1q_u16(dst + (5 * ds), COL(high, u1.val[0], u3.val[0]));
+    vst1q_u16(dst + (6 * ds), COL(high, u0.val[1], u2.val[1]));
+    vst1q_u16(dst + (7 * ds), COL(high, u1.val[1], u3.val[1]));
+#undef COL
+}
+
+#elif defined(ROTATE_SSE2)
+#define TILE16 8
+
+#if defined(__AVX__)
+#define TILE32 8
+
+static inline void tile32(uint32_t *dst, ptrdiff_t ds, const uint32_t *src,
+  ptrdiff_t ss)
+{
+    __m256 r[8], t[8], s[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = _mm256_loadu_ps((const float *)(src + (i * ss)));
+
+    for (i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+        s[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3],
+          _MM_SHUFFLE(1, 0, 1, 0));
+        s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3],
+          _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (i = 0; i < 4; i++) {
+        _mm256_storeu_ps((float *)(dst + (i * ds)),
+          _mm256_permute2f128_ps(s[i], s[i + 4], 0x20));
+        _mm256_storeu_ps((float *)(dst + ((i + 4) * ds)),
+          _mm256_permute2f128_ps(s[i], s[i + 4], 0x31));
+    }
+}
+
+#else
+#define TILE32 4
+
+static inline void tile32(uint32_t *dst, ptrdiff_t ds, const uint32_t *src,
+  ptrdiff_t ss)
+{
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+    r0 = _mm_loadu_si128((const __m128i *)src);
+    r1 = _mm_loadu_si128((const __m128i *)(src + ss));
+    r2 = _mm_loadu_si128((const __m128i *)(src + (2 * ss)));
+    r3 = _mm_loadu_si128((const __m128i *)(src + (3 * ss)));
+
+    t0 = _mm_unpacklo_epi32(r0, r1);
+    t1 = _mm_unpacklo_epi32(r2, r3);
+    t2 = _mm_unpackhi_epi32(r0, r1);
+    t3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dst + ds), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dst + (2 * ds)), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(dst + (3 * ds)), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+static inline void tile16(uint16_t *dst, ptrdiff_t ds, const uint16_t *src,
+  ptrdiff_t ss)
+{
+    __m128i r[8], a[8], b[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = _mm_loadu_si128((const __m128i *)(src + (i * ss)));
+
+    for (i = 0; i < 4; i++) {
+        a[i] = _mm_unpacklo_epi16(r[2 * i], r[(2 * i) + 1]);
+        a[i + 4] = _mm_unpackhi_epi16(r[2 * i], r[(2 * i) + 1]);
+    }
+    for (i = 0; i < 8; i += 2) {
+        b[i] = _mm_unpacklo_epi32(a[i], a[i + 1]);
+        b[i + 1] = _mm_unpackhi_epi32(a[i], a[i + 1]);
+    }
+    for (i = 0; i < 2; i++) {
+        _mm_storeu_si128((__m128i *)(dst + ((4 * i) * ds)),
+          _mm_unpacklo_epi64(b[4 * i], b[(4 * i) + 2]));
+        _mm_storeu_si128((__m128i *)(dst + (((4 * i) + 1) * ds)),
+          _mm_unpackhi_epi64(b[4 * i], b[(4 * i) + 2]));
+        _mm_storeu_si128((__m128i *)(dst + (((4 * i) + 2) * ds)),
+          _mm_unpacklo_epi64(b[(4 * i) + 1], b[(4 * i) + 3]));
+        _mm_storeu_si128((__m128i *)(dst + (((4 * i) + 3) * ds)),
+          _mm_unpackhi_epi64(b[(4 * i) + 1], b[(4 * i) + 3]));
+    }
+}
+
+#else
+#define TILE32 1
+#define TILE16 1
+
+/* A tile of a single pixel has no strides to use */
+static inline void tile32(uint32_t *dst, ptrdiff_t ds, const uint32_t *src,
+  ptrdiff_t ss)
+{
+    (void)ds;
+    (void)ss;
+    *dst = *src;
+}
+
+static inline void tile16(uint16_t *dst, ptrdiff_t ds, const uint16_t *src,
+  ptrdiff_t ss)
+{
+    (void)ds;
+    (void)ss;
+    *dst = *src;
+}
+#endif
+
+/* dst[x][y] = src[y][x] for a `w` x `h` source, a block and then a tile at a
+ * time. Whatever doesn't fill a whole tile at the right and bottom edges of a
+ * block is copied a pixel at a time.
+ */
+#define DEFINE_TRANSPOSE(name, type, tile, T) \
+static void name(type *dst, ptrdiff_t ds, const type *src, ptrdiff_t ss, \
+  int w, int h) \
+{ \
+    int bx, by, x, y, xe, ye, xt, yt; \
+\
+    for (by = 0; by < h; by += ROT_BLOCK) { \
+        ye = LV_MIN(by + ROT_BLOCK, h); \
+        yt = by + (((ye - by) / T) * T); \
+        for (bx = 0; bx < w; bx += ROT_BLOCK) { \
+            xe = LV_MIN(bx + ROT_BLOCK, w); \
+            xt = bx + (((xe - bx) / T) * T); \
+\
+            for (y = by; y < yt; y += T) { \
+                for (x = bx; x < xt; x += T) \
+                    tile(dst + (x * ds) + y, ds, src + (y * ss) + x, ss); \
+            } \
+            for (y = by; y < ye; y++) { \
+                for (x = (y < yt) ? xt : bx; x < xe; x++) \
+                    dst[(x * ds) + y] = src[(y * ss) + x]; \
+            } \
+        } \
+    } \
+}
+
+DEFINE_TRANSPOSE(transpose32, uint32_t, tile32, TILE32)
+DEFINE_TRANSPOSE(transpose16, uint16_t, tile16, TILE16)
+
+int rotate_copy(void *dst, size_t dst_stride, const void *src,
+  size_t src_stride, int w, int h, unsigned int bpp, lv_disp_rot_t rot)
+{
+    ptrdiff_t ds, ss;
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if ((bpp != 16 && bpp != 32) ||
+      (rot != LV_DISP_ROT_90 && rot != LV_DISP_ROT_270))
+        return -1;
+
+    ds = dst_stride / (bpp / 8);
+    ss = src_stride / (bpp / 8);
+
+    /* Clockwise, the bottom source row becomes the left destination column.
+     * Counter-clockwise, the right source column becomes the top destination
+     * row.
+     */
+    if (rot == LV_DISP_ROT_270) {
+        s += (h - 1) * src_stride;
+        ss = -ss;
+    } else {
+        d += (w - 1) * dst_stride;
+        ds = -ds;
+    }
+
+    if (bpp == 32)
+        transpose32((uint32_t *)d, ds, (const uint32_t *)s, ss, w, h);
+    else
+        transpose16((uint16_t *)d, ds, (const uint16_t *)s, ss, w, h);
+
+    return 0;
+}
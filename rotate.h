@@ -0,0 +1,24 @@
+#ifndef __ROTATE_H__
+#define __ROTATE_H__
+#include <stddef.h>
+
+#include "lvgl/lvgl.h"
+
+/* Rotate a `w` x `h` block of 16 or 32 bpp pixels while copying it, e.g.
+ * straight from a draw buffer into the framebuffer. `dst` is the top left of
+ * the rotated block, which is `h` pixels wide and `w` tall. Strides are in
+ * bytes.
+ *
+ * `rot` follows LVGL, LV_DISP_ROT_270 turns the block clockwise and
+ * LV_DISP_ROT_90 counter-clockwise.
+ *
+ * The copy is done in small tiles that are transposed in registers, NEON on
+ * ARM and SSE2/AVX on x86 when the compiler targets them, so that both the
+ * source and destination are walked in cache friendly order.
+ *
+ * Returns -1 if the depth or rotation isn't handled, nothing is written then.
+ */
+int rotate_copy(void *dst, size_t dst_stride, const void *src,
+  size_t src_stride, int w, int h, unsigned int bpp, lv_disp_rot_t rot);
+
+#endif // __ROTATE_H__
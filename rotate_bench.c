@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rotate.h"
+
+/* Times rotate_copy() against the per pixel gather the flush worker used to
+ * rotate with, on a full screen and on a meter sized area, at 16 and 32 bpp.
+ * The gather only ever turned clockwise, so that is what is compared, and
+ * each result is checked against it. Build with -DSIMD=OFF to time
+ * rotate_copy()'s plain C path instead.
+ */
+#define BENCH_MS 200
+
+struct bench_area {
+    const char *name;
+    int w;
+    int h;
+};
+
+static const struct bench_area bench_area[] = {
+    { "full screen", 320, 240 },
+    { "meter", 230, 230 },
+};
+
+/* Each source column, bottom to top, gathered into a row and written out */
+#define DEFINE_GATHER(name, type) \
+static void name(void *dst, size_t dst_stride, const void *src, \
+  size_t src_stride, int w, int h) \
+{ \
+    static type row_buf[1024]; \
+    const type *p; \
+    int x, i; \
+\
+    for (x = 0; x < w; x++) { \
+        p = (const type *)((const uint8_t *)src + ((h - 1) * src_stride)) + \
+          x; \
+        for (i = 0; i < h; i++, p = (const type *)((const uint8_t *)p - \
+          src_stride)) \
+            row_buf[i] = *p; \
+        memcpy((uint8_t *)dst + (x * dst_stride), row_buf, \
+          h * sizeof(type)); \
+    } \
+}
+
+DEFINE_GATHER(gather32, uint32_t)
+DEFINE_GATHER(gather16, uint16_t)
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int main(void)
+{
+    const struct bench_area *a;
+    size_t size, src_stride, dst_stride;
+    uint64_t start, end, gather_ns, rotate_ns, n;
+    unsigned int bpp, i;
+    uint8_t *src, *dst, *ref;
+    int ret = 0;
+
+    size = 1024 * 1024 * 4;
+    src = malloc(size);
+    dst = malloc(size);
+    ref = malloc(size);
+    if (src == NULL || dst == NULL || ref == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < size; i++)
+        src[i] = rand();
+
+    printf("%-12s %4s %10s %10s %8s\n", "area", "bpp", "gather us",
+      "rotate us", "speedup");
+
+    for (i = 0; i < sizeof(bench_area) / sizeof(bench_area[0]); i++) {
+        a = &bench_area[i];
+        for (bpp = 16; bpp <= 32; bpp += 16) {
+            src_stride = a->w * (bpp / 8);
+            dst_stride = a->h * (bpp / 8);
+
+            n = 0;
+            start = bench_now_ns();
+            do {
+                if (bpp == 32)
+                    gather32(ref, dst_stride, src, src_stride, a->w, a->h);
+                else
+                    gather16(ref, dst_stride, src, src_stride, a->w, a->h);
+                n++;
+                end = bench_now_ns();
+            } while (end - start < BENCH_MS * 1000000ULL);
+            gather_ns = (end - start) / n;
+
+            n = 0;
+            start = bench_now_ns();
+            do {
+                rotate_copy(dst, dst_stride, src, src_stride, a->w, a->h, bpp,
+                  LV_DISP_ROT_270);
+                n++;
+                end = bench_now_ns();
+            } while (end - start < BENCH_MS * 1000000ULL);
+            rotate_ns = (end - start) / n;
+
+            printf("%-12s %4u %10.1f %10.1f %7.1fx\n", a->name, bpp,
+              gather_ns / 1000.0, rotate_ns / 1000.0,
+              (double)gather_ns / rotate_ns);
+
+            if (memcmp(dst, ref, a->w * dst_stride) != 0) {
+                fprintf(stderr, "%s at %u bpp doesn't match the gather\n",
+                  a->name, bpp);
+                ret = 1;
+            }
+        }
+    }
+
+    free(src);
+    free(dst);
+    free(ref);
+
+    return ret;
+}
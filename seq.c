@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "loop.h"
+#include "seq.h"
+#include "stats.h"
+
+struct seq {
+    GPIOL1 *gpio;
+    struct seq_prog prog;
+    /* Step whose edge is next, how many passes are done, and when it's due */
+    unsigned int step;
+    unsigned int pass;
+    uint64_t next_ns;
+    struct seq_report report;
+    void (*done)(const struct seq_report *report, bool oval, void *user_data);
+    void *user_data;
+};
+
+/* Everything below is only touched by the I/O thread */
+static struct seq *seq_active[SEQ_MAX];
+static int seq_timer_fd = -1;
+
+static uint64_t seq_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static bool seq_parse_u64(const char **p, uint64_t *val)
+{
+    char *end;
+
+    errno = 0;
+    *val = strtoull(*p, &end, 10);
+    if (end == *p || errno != 0)
+        return false;
+    *p = end;
+
+    return true;
+}
+
+static bool seq_parse_sep(const char **p, char sep)
+{
+    if (**p != sep)
+        return false;
+    (*p)++;
+
+    return true;
+}
+
+int seq_parse(const char *spec, struct seq_prog *prog)
+{
+    const char *p;
+    uint64_t a, b, c;
+
+    memset(prog, 0, sizeof(*prog));
+
+    if (strncmp(spec, "pulse:", 6) == 0) {
+        p = spec + 6;
+        if (!seq_parse_u64(&p, &a) || !seq_parse_sep(&p, ':') ||
+          !seq_parse_u64(&p, &b) || !seq_parse_sep(&p, ':') ||
+          !seq_parse_u64(&p, &c) || *p != '\0')
+            return -1;
+        if (a == 0 || b == 0 || c > UINT32_MAX)
+            return -1;
+
+        prog->step[0] = (struct seq_step){ true, a };
+        prog->step[1] = (struct seq_step){ false, b };
+        prog->n = 2;
+        prog->repeat = c;
+    } else if (strncmp(spec, "pwm:", 4) == 0) {
+        p = spec + 4;
+        if (!seq_parse_u64(&p, &a) || !seq_parse_sep(&p, ':') ||
+          !seq_parse_u64(&p, &b) || *p != '\0')
+            return -1;
+        if (a == 0 || b > 100)
+            return -1;
+
+        /* 0 and 100 % are a steady level, not a pulse of no width */
+        if (b == 0 || b == 100) {
+            prog->step[0] = (struct seq_step){ b == 100, a };
+            prog->n = 1;
+        } else {
+            prog->step[0] = (struct seq_step){ true, (a * b) / 100 };
+            prog->step[1] = (struct seq_step){ false, a - prog->step[0].us };
+            prog->n = 2;
+        }
+        prog->repeat = 0;
+    } else if (strncmp(spec, "sched:", 6) == 0) {
+        p = spec + 6;
+        do {
+            if (prog->n == SEQ_STEP_MAX)
+                return -1;
+            if (!seq_parse_u64(&p, &a) || a > 1 || !seq_parse_sep(&p, '/') ||
+              !seq_parse_u64(&p, &b) || b == 0)
+                return -1;
+            prog->step[prog->n++] = (struct seq_step){ a, b };
+        } while (seq_parse_sep(&p, ','));
+
+        if (!seq_parse_sep(&p, ':') || !seq_parse_u64(&p, &c) ||
+          *p != '\0' || c > UINT32_MAX)
+            return -1;
+        prog->repeat = c;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Arm the timer for the earliest edge still to come, or disarm it */
+static void seq_arm(void)
+{
+    struct itimerspec its = {};
+    uint64_t next = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < SEQ_MAX; i++) {
+        if (seq_active[i] != NULL && seq_active[i]->next_ns < next)
+            next = seq_active[i]->next_ns;
+    }
+
+    if (next != UINT64_MAX) {
+        /* An all zero value disarms, and the first edge may well be due at 0 */
+        its.it_value.tv_sec = next / 1000000000ULL;
+        its.it_value.tv_nsec = next % 1000000000ULL;
+        if (next == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(seq_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static bool seq_last_edge(const struct seq *s)
+{
+    return s->prog.repeat != 0 && s->pass == s->prog.repeat - 1 &&
+      s->step == s->prog.n - 1;
+}
+
+static void seq_advance(struct seq *s)
+{
+    s->next_ns += s->prog.step[s->step].us * 1000ULL;
+    if (++s->step == s->prog.n) {
+        s->step = 0;
+        s->pass++;
+    }
+}
+
+/* Back on the UI thread once a program has ended */
+static void seq_end_done(const struct io_cmd *cmd)
+{
+    struct seq *s = cmd->user_data;
+    unsigned int last = (s->step + s->prog.n - 1) % s->prog.n;
+
+    if (s->done != NULL)
+        s->done(&s->report, s->prog.step[last].oval, s->user_data);
+    free(s);
+}
+
+static void seq_end(int i)
+{
+    struct seq *s = seq_active[i];
+
+    seq_active[i] = NULL;
+    if (io_done(seq_end_done, 0, s) == -1)
+        free(s);
+}
+
+void seq_run(void)
+{
+    int idx[SEQ_MAX];
+    GPIOL1 *gpio[SEQ_MAX];
+    bool oval[SEQ_MAX];
+    uint64_t now, late;
+    struct seq *s;
+    int i, n = 0;
+
+    loop_efd_drain(seq_timer_fd);
+
+    now = seq_now_ns();
+    for (i = 0; i < SEQ_MAX; i++) {
+        s = seq_active[i];
+        if (s == NULL || s->next_ns > now)
+            continue;
+
+        /* Only the latest edge that is due gets written */
+        while (!seq_last_edge(s) &&
+          s->next_ns + (s->prog.step[s->step].us * 1000ULL) <= now) {
+            seq_advance(s);
+            s->report.skipped++;
+        }
+
+        idx[n] = i;
+        gpio[n] = s->gpio;
+        oval[n++] = s->prog.step[s->step].oval;
+    }
+
+    if (n == 0)
+        return;
+
+    if (gpio_group_oval_set(gpio, oval, n) == -1)
+        perror("seq: GPIO write");
+    now = seq_now_ns();
+
+    for (i = 0; i < n; i++) {
+        s = seq_active[idx[i]];
+
+        late = (now - s->next_ns) / 1000;
+        stats_record(STAT_SEQ_LATE_US, late);
+        s->report.edges++;
+        s->report.late_sum_us += late;
+        if (late > s->report.late_max_us)
+            s->report.late_max_us = late;
+
+        if (seq_last_edge(s)) {
+            seq_advance(s);
+            seq_end(idx[i]);
+        } else {
+            seq_advance(s);
+        }
+    }
+
+    seq_arm();
+}
+
+/* Runs on the I/O thread. A program already on the output is ended first. */
+static int seq_load(void *user_data)
+{
+    struct seq *s = user_data;
+    int i, slot = -1;
+
+    for (i = 0; i < SEQ_MAX; i++) {
+        if (seq_active[i] != NULL && seq_active[i]->gpio == s->gpio)
+            seq_end(i);
+        if (seq_active[i] == NULL && slot == -1)
+            slot = i;
+    }
+
+    if (slot == -1 || seq_timer_fd == -1) {
+        errno = (slot == -1) ? EBUSY : ENODEV;
+        return -1;
+    }
+
+    s->next_ns = seq_now_ns();
+    seq_active[slot] = s;
+    seq_arm();
+
+    return 0;
+}
+
+/* On the UI thread, only anything to do if the program never started */
+static void seq_load_done(const struct io_cmd *cmd)
+{
+    struct seq *s = cmd->user_data;
+
+    if (cmd->ret == 0)
+        return;
+
+    fprintf(stderr, "Sequencer start failed: %s\n", strerror(cmd->err));
+    if (s->done != NULL)
+        s->done(NULL, false, s->user_data);
+    free(s);
+}
+
+int seq_start(GPIOL1 *gpio, const struct seq_prog *prog,
+  void (*done)(const struct seq_report *report, bool oval, void *user_data),
+  void *user_data)
+{
+    struct seq *s;
+
+    if (prog->n == 0 || prog->n > SEQ_STEP_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return -1;
+
+    s->gpio = gpio;
+    s->prog = *prog;
+    s->done = done;
+    s->user_data = user_data;
+
+    if (io_call(seq_load, seq_load_done, s) == -1) {
+        free(s);
+        return -1;
+    }
+
+    return 0;
+}
+
+int seq_init(void)
+{
+    seq_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    return seq_timer_fd;
+}
@@ -0,0 +1,73 @@
+#ifndef __SEQ_H__
+#define __SEQ_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpiolib1.h"
+#include "io.h"
+
+/* The sequencer drives outputs through timed programs, e.g. pulse trains,
+ * on/off schedules, or software PWM. It runs on the I/O thread, which is the
+ * only one that writes GPIO, and sleeps on a timerfd armed with absolute
+ * CLOCK_MONOTONIC deadlines. Every edge is due a fixed time after the start
+ * of the program, so lateness never accumulates. Edges that fall due at the
+ * same time are written together, see gpio_group_oval_set().
+ *
+ * If the thread falls behind by more than one edge, only the latest edge
+ * that is due is written and the earlier ones are counted as skipped, rather
+ * than squeezing out pulses that are shorter than requested.
+ */
+
+/* Most steps in one program, and most programs running at once */
+#define SEQ_STEP_MAX 16
+#define SEQ_MAX 8
+
+struct seq_step {
+    bool oval;
+    uint64_t us;            /* held for, before the next step */
+};
+
+struct seq_prog {
+    struct seq_step step[SEQ_STEP_MAX];
+    unsigned int n;
+    unsigned int repeat;    /* passes over the steps, 0 for no end */
+};
+
+/* Achieved against requested timing of the edges of one program. `late` is
+ * from an edge being due to its write having returned.
+ */
+struct seq_report {
+    uint64_t edges;
+    uint64_t skipped;
+    uint64_t late_sum_us;
+    uint64_t late_max_us;
+};
+
+/* Parse a program from the command line, one of:
+ *
+ *   pulse:ON_US:OFF_US:COUNT     COUNT high pulses, 0 for no end
+ *   pwm:PERIOD_US:DUTY_PCT       software PWM, never ends
+ *   sched:L/US,L/US,...:REPEAT   level L held for US, REPEAT passes
+ *
+ * Returns -1 if it isn't valid.
+ */
+int seq_parse(const char *spec, struct seq_prog *prog);
+
+/* Start running `prog` on an output, from the UI thread, in place of any
+ * program already on it. The program is copied and the first edge is written
+ * right away. If the program ends, `done` is called on the UI thread with the
+ * timing of its edges and the level the output was left at, or with a NULL
+ * `report` if it never started. Returns -1 if it couldn't be posted.
+ */
+int seq_start(GPIOL1 *gpio, const struct seq_prog *prog,
+  void (*done)(const struct seq_report *report, bool oval, void *user_data),
+  void *user_data);
+
+/* For the I/O thread only. seq_init() returns the fd to wait on, -1 on error,
+ * and seq_run() writes whatever edges are due once it is readable.
+ */
+int seq_init(void);
+
+void seq_run(void);
+
+#endif // __SEQ_H__
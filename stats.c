@@ -0,0 +1,115 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lvgl/lvgl.h"
+#include "stats.h"
+
+struct stat {
+    const char *name;
+    const char *unit;
+    atomic_ullong n;
+    atomic_ullong sum;
+    atomic_ullong max;
+};
+
+/* Indexed by enum stat_id */
+static struct stat stats[STAT_MAX] = {
+    [STAT_FRAME_MS] = { "frame", "ms" },
+    [STAT_RENDER_US] = { "render", "us" },
+    [STAT_FLUSH_US] = { "flush", "us" },
+    [STAT_FRAME_FLUSH_US] = { "frame flush", "us" },
+    [STAT_DIFF_US] = { "diff", "us" },
+    [STAT_WAIT_US] = { "flush wait", "us" },
+    [STAT_PRESENT_US] = { "present", "us" },
+    [STAT_FLUSH_BYTES] = { "flushed", "B" },
+    [STAT_PANEL_BYTES] = { "panel", "B" },
+    [STAT_GPIO_POST_US] = { "gpio post", "us" },
+    [STAT_GPIO_US] = { "gpio", "us" },
+    [STAT_TAB_SWITCH_MS] = { "tab switch", "ms" },
+    [STAT_SEQ_LATE_US] = { "seq late", "us" },
+    [STAT_CAP_EDGES] = { "cap edges", "edges" },
+    [STAT_CAP_LOST] = { "cap lost", "edges" },
+    [STAT_LA_DRAW_US] = { "la draw", "us" },
+    [STAT_ADC_SCANS] = { "adc scans", "scans" },
+    [STAT_ADC_FILTER_US] = { "adc filter", "us" },
+    [STAT_TREND_US] = { "trend", "us" },
+    [STAT_LOG_ENCODE_US] = { "log encode", "us" },
+    [STAT_LOG_SYNC_US] = { "log sync", "us" },
+    [STAT_LOG_LOST] = { "log lost", "scans" },
+};
+
+static bool stats_on;
+
+uint64_t stats_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+void stats_record(enum stat_id id, uint64_t val)
+{
+    struct stat *s = &stats[id];
+    unsigned long long max;
+
+    if (!stats_on)
+        return;
+
+    atomic_fetch_add_explicit(&s->n, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum, val, memory_order_relaxed);
+
+    max = atomic_load_explicit(&s->max, memory_order_relaxed);
+    while (val > max && !atomic_compare_exchange_weak_explicit(&s->max, &max,
+      val, memory_order_relaxed, memory_order_relaxed));
+}
+
+/* Resident set size from /proc, in kB */
+static long stats_rss_kb(void)
+{
+    long size, pages = -1;
+    FILE *f;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &size, &pages) != 2)
+        pages = -1;
+    fclose(f);
+
+    return (pages < 0) ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void stats_report_cb(lv_timer_t *timer)
+{
+    unsigned long long n, sum, max;
+    struct stat *s;
+    int i;
+
+    fprintf(stderr, "rss: %ld kB\n", stats_rss_kb());
+
+    for (i = 0; i < STAT_MAX; i++) {
+        s = &stats[i];
+        n = atomic_exchange_explicit(&s->n, 0, memory_order_relaxed);
+        sum = atomic_exchange_explicit(&s->sum, 0, memory_order_relaxed);
+        max = atomic_exchange_explicit(&s->max, 0, memory_order_relaxed);
+        if (n == 0)
+            continue;
+
+        fprintf(stderr, "%s: n %llu avg %llu %s max %llu %s\n", s->name, n,
+          sum / n, s->unit, max, s->unit);
+    }
+}
+
+void stats_enable(void)
+{
+    stats_on = true;
+    lv_timer_create(stats_report_cb, 1000, NULL);
+}
+
+bool stats_enabled(void)
+{
+    return stats_on;
+}
@@ -0,0 +1,48 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Lightweight counters for measuring the demo on real hardware. Recording is
+ * a few atomic adds and is safe from any thread. When enabled with `-s`, a
+ * summary of each counter that saw samples is printed to stderr once a
+ * second, along with the process' RSS, and the counters are reset.
+ */
+
+enum stat_id {
+    STAT_FRAME_MS,      /* LVGL refresh time, render plus flush wait */
+    STAT_RENDER_US,     /* LVGL refresh time less flush wait, per frame */
+    STAT_FLUSH_US,      /* flush worker, per flushed area */
+    STAT_FRAME_FLUSH_US, /* flush worker, per frame */
+    STAT_DIFF_US,       /* finding what changed, per flushed area */
+    STAT_WAIT_US,       /* UI thread blocked on the flush worker */
+    STAT_PRESENT_US,    /* backend present, e.g. waiting on a page flip */
+    STAT_FLUSH_BYTES,   /* written by the flush worker, per frame */
+    STAT_PANEL_BYTES,   /* sent on to the panel by the kernel, per frame */
+    STAT_GPIO_POST_US,  /* UI thread posting a GPIO write */
+    STAT_GPIO_US,       /* GPIO write posted to the lines changed */
+    STAT_TAB_SWITCH_MS, /* Longest frame of a tab change's scroll */
+    STAT_SEQ_LATE_US,   /* sequencer edge written, after it was due */
+    STAT_CAP_EDGES,     /* captured edges handed to the UI, per wakeup */
+    STAT_CAP_LOST,      /* captured edges dropped with the ring full */
+    STAT_LA_DRAW_US,    /* drawing the logic analyzer trace */
+    STAT_ADC_SCANS,     /* ADC scans read per buffer refill */
+    STAT_ADC_FILTER_US, /* converting and filtering one refill */
+    STAT_TREND_US,      /* reading back the ADC history for the trend */
+    STAT_LOG_ENCODE_US, /* ADC log encoding one hand over of scans */
+    STAT_LOG_SYNC_US,   /* ADC log syncing its segment to storage */
+    STAT_LOG_LOST,      /* ADC scans dropped with the log's ring full */
+    STAT_MAX,
+};
+
+void stats_record(enum stat_id id, uint64_t val);
+
+/* Start the once a second report, must be called from the UI thread */
+void stats_enable(void);
+
+bool stats_enabled(void);
+
+/* CLOCK_MONOTONIC in microseconds, for timing things to record */
+uint64_t stats_now_us(void);
+
+#endif // __STATS_H__
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <time.h>
+#include "lvgl/lvgl.h"
+
+#include "hist.h"
+#include "stats.h"
+#include "trend.h"
+
+/* Most columns the chart can be wide, one point per pixel */
+#define TREND_COLS_MAX 512
+
+#define TREND_PAD 4
+#define TREND_ZOOM_H 36
+/* Room left of the chart for the Y axis labels */
+#define TREND_AXIS_W 48
+
+/* Redrawn once a column's worth of time has passed, within limits */
+#define TREND_REFRESH_MIN_MS 250
+#define TREND_REFRESH_MAX_MS 10000
+
+static const char *trend_zoom_map[] = {
+    "10 s", "1 min", "10 min", "1 h", "6 h", "24 h", "",
+};
+
+static const uint32_t trend_zoom_s[] = {
+    10, 60, 10 * 60, 60 * 60, 6 * 60 * 60, 24 * 60 * 60,
+};
+
+/* In the same order as adc_desc, and in the same colors as the meter */
+static const lv_palette_t trend_color[HIST_CHAN_MAX] = {
+    LV_PALETTE_RED, LV_PALETTE_GREEN, LV_PALETTE_BLUE, LV_PALETTE_ORANGE,
+};
+
+static lv_obj_t *trend_chart;
+static lv_timer_t *trend_timer;
+static unsigned int trend_cols;
+static unsigned int trend_zoom;
+
+/* The min and max as read back, and the chart's points made from them */
+static int16_t trend_min[HIST_CHAN_MAX][TREND_COLS_MAX];
+static int16_t trend_max[HIST_CHAN_MAX][TREND_COLS_MAX];
+static lv_coord_t trend_min_pts[HIST_CHAN_MAX][TREND_COLS_MAX];
+static lv_coord_t trend_max_pts[HIST_CHAN_MAX][TREND_COLS_MAX];
+
+static uint64_t trend_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t trend_col_ns(void)
+{
+    return (trend_zoom_s[trend_zoom] * 1000000000ULL) / trend_cols;
+}
+
+static void trend_timer_cb(lv_timer_t *timer)
+{
+    uint64_t start = stats_now_us();
+    int16_t *min[HIST_CHAN_MAX], *max[HIST_CHAN_MAX];
+    int32_t lo = INT32_MAX, hi = INT32_MIN, margin;
+    unsigned int i, c;
+
+    for (i = 0; i < HIST_CHAN_MAX; i++) {
+        min[i] = trend_min[i];
+        max[i] = trend_max[i];
+    }
+    hist_read(trend_now_ns(), trend_col_ns(), trend_cols, min, max);
+
+    for (i = 0; i < HIST_CHAN_MAX; i++) {
+        for (c = 0; c < trend_cols; c++) {
+            if (trend_min[i][c] > trend_max[i][c]) {
+                trend_min_pts[i][c] = LV_CHART_POINT_NONE;
+                trend_max_pts[i][c] = LV_CHART_POINT_NONE;
+                continue;
+            }
+            trend_min_pts[i][c] = trend_min[i][c];
+            trend_max_pts[i][c] = trend_max[i][c];
+            lo = LV_MIN(lo, trend_min[i][c]);
+            hi = LV_MAX(hi, trend_max[i][c]);
+        }
+    }
+
+    /* Fit the range to what is on screen, with a little room around it */
+    if (lo > hi) {
+        lo = 0;
+        hi = 1000;
+    }
+    margin = LV_MAX((hi - lo) / 10, 10);
+    lv_chart_set_range(trend_chart, LV_CHART_AXIS_PRIMARY_Y, lo - margin,
+      hi + margin);
+    lv_chart_refresh(trend_chart);
+
+    stats_record(STAT_TREND_US, stats_now_us() - start);
+}
+
+static void trend_zoom_cb(lv_event_t *e)
+{
+    lv_obj_t *zoom = lv_event_get_target(e);
+    uint64_t period;
+
+    trend_zoom = lv_btnmatrix_get_selected_btn(zoom);
+    if (trend_zoom >= sizeof(trend_zoom_s) / sizeof(trend_zoom_s[0]))
+        trend_zoom = 0;
+
+    period = trend_col_ns() / 1000000;
+    period = LV_MAX(period, TREND_REFRESH_MIN_MS);
+    period = LV_MIN(period, TREND_REFRESH_MAX_MS);
+    lv_timer_set_period(trend_timer, period);
+    lv_timer_ready(trend_timer);
+}
+
+void trend_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width)
+{
+    lv_chart_series_t *ser;
+    lv_obj_t *zoom;
+    lv_coord_t chart_w, chart_h;
+    unsigned int i;
+
+    zoom = lv_btnmatrix_create(tab);
+    lv_btnmatrix_set_map(zoom, trend_zoom_map);
+    lv_btnmatrix_set_btn_ctrl_all(zoom, LV_BTNMATRIX_CTRL_CHECKABLE);
+    lv_btnmatrix_set_one_checked(zoom, true);
+    lv_btnmatrix_set_btn_ctrl(zoom, 0, LV_BTNMATRIX_CTRL_CHECKED);
+    lv_obj_set_size(zoom, width, TREND_ZOOM_H);
+    lv_obj_align(zoom, LV_ALIGN_TOP_MID, 0, 0);
+    lv_obj_set_style_pad_all(zoom, 2, LV_PART_MAIN);
+    lv_obj_set_style_text_font(zoom, &lv_font_montserrat_10, LV_PART_MAIN);
+    lv_obj_add_event_cb(zoom, trend_zoom_cb, LV_EVENT_VALUE_CHANGED, NULL);
+
+    chart_w = width - TREND_AXIS_W - TREND_PAD;
+    chart_h = height - TREND_ZOOM_H - (3 * TREND_PAD);
+    trend_chart = lv_chart_create(tab);
+    lv_obj_set_size(trend_chart, chart_w, chart_h);
+    lv_obj_align(trend_chart, LV_ALIGN_BOTTOM_RIGHT, -TREND_PAD, -TREND_PAD);
+    lv_obj_set_style_pad_all(trend_chart, TREND_PAD, LV_PART_MAIN);
+    lv_chart_set_type(trend_chart, LV_CHART_TYPE_LINE);
+    lv_chart_set_div_line_count(trend_chart, 5, 6);
+    lv_chart_set_axis_tick(trend_chart, LV_CHART_AXIS_PRIMARY_Y, 6, 3, 6, 2,
+      true, TREND_AXIS_W);
+    lv_obj_set_style_text_font(trend_chart, &lv_font_montserrat_10,
+      LV_PART_TICKS);
+    /* Lines only, no dots on every point */
+    lv_obj_set_style_size(trend_chart, 0, LV_PART_INDICATOR);
+    lv_obj_set_style_line_width(trend_chart, 1, LV_PART_ITEMS);
+
+    /* One point per pixel column */
+    trend_cols = LV_MIN(chart_w - (2 * TREND_PAD), TREND_COLS_MAX);
+    lv_chart_set_point_count(trend_chart, trend_cols);
+
+    /* The min and max of a channel, in the same color, make an envelope that
+     * closes up to a single line where it held steady over each column.
+     * The points are kept in place here rather than in LVGL's heap.
+     */
+    for (i = 0; i < HIST_CHAN_MAX; i++) {
+        ser = lv_chart_add_series(trend_chart,
+          lv_palette_main(trend_color[i]), LV_CHART_AXIS_PRIMARY_Y);
+        lv_chart_set_ext_y_array(trend_chart, ser, trend_max_pts[i]);
+        ser = lv_chart_add_series(trend_chart,
+          lv_palette_main(trend_color[i]), LV_CHART_AXIS_PRIMARY_Y);
+        lv_chart_set_ext_y_array(trend_chart, ser, trend_min_pts[i]);
+    }
+
+    trend_timer = lv_timer_create(trend_timer_cb, TREND_REFRESH_MIN_MS, NULL);
+    lv_timer_pause(trend_timer);
+}
+
+void trend_set_active(bool active)
+{
+    if (trend_timer == NULL)
+        return;
+
+    if (active) {
+        lv_timer_resume(trend_timer);
+        lv_timer_ready(trend_timer);
+    } else {
+        lv_timer_pause(trend_timer);
+    }
+}
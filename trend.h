@@ -0,0 +1,13 @@
+#ifndef __TREND_H__
+#define __TREND_H__
+#include <stdbool.h>
+
+/* A trend chart of the ADC history kept by hist.h, from the last 10 s up to
+ * the last 24 h, with the min and max of each channel drawn per pixel.
+ */
+void trend_create(lv_obj_t *tab, lv_coord_t height, lv_coord_t width);
+
+/* Only refresh the chart while it is on screen */
+void trend_set_active(bool active);
+
+#endif // __TREND_H__